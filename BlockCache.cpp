@@ -0,0 +1,182 @@
+#include <SD.h>
+#include <BlockCache.h>
+#include <Stats.h>
+
+BlockCache block_cache;
+
+BlockCache::BlockCache(){
+	card = NULL;
+	reading = 0;
+	for (unsigned char i = 0; i < cache_blocks; i++) {
+		file[i] = 0;
+		block[i] = 0;
+		len[i] = 0;
+		used[i] = 0;
+		locks[i] = 0;
+		hits[i] = 0;
+		misses[i] = 0;
+	}
+	clock = 0;
+}
+
+// the block of sd_file numbered block, read from microsd if it isn't cached.
+// len is set to the number of bytes in it. returns NULL if the file isn't
+// open, the block can't be read, or every block is locked (the caller then
+// reads it some other way).
+
+unsigned char* BlockCache::get(CachedFile* sd_file, uint32_t block, unsigned int* len){
+	if (!sd_file->isOpen()) return NULL;
+
+	int slot = lookup(sd_file->firstCluster(), block);
+
+	if (slot >= 0) {
+		hits[slot]++;
+	}
+	else if ((slot = load(sd_file, block)) < 0) {
+		return NULL;
+	}
+	touch(slot);
+	*len = this->len[slot];
+	return data[slot];
+}
+
+// a block only if it's cached already. file is the first cluster of its file.
+
+unsigned char* BlockCache::find(uint32_t file, uint32_t block, unsigned int* len){
+	int slot = lookup(file, block);
+
+	if (slot < 0) return NULL;
+	hits[slot]++;
+	touch(slot);
+	*len = this->len[slot];
+	return data[slot];
+}
+
+// read a block that's about to be wanted, if it isn't cached already. returns
+// false if there was no room for it, or it couldn't be read.
+
+bool BlockCache::readAhead(CachedFile* sd_file, uint32_t block){
+	if (!sd_file->isOpen()) return false;
+
+	int slot = lookup(sd_file->firstCluster(), block);
+
+	if (slot < 0 && (slot = load(sd_file, block)) < 0) return false;
+	touch(slot);
+	return true;
+}
+
+// with the card, blocks of contiguous files are read from it directly.
+
+void BlockCache::begin(Sd2Card* card){
+	this->card = card;
+	reading = 0;
+}
+
+// end a multi-block read. the card can't do anything else until then, so
+// this is called once a batch of blocks is read, before anything else (the
+// library index, a directory, ...) gets to read from the card.
+
+void BlockCache::stop(){
+	if (reading) {
+		card->readStop();
+		reading = 0;
+	}
+}
+
+// a block stays locked until every stream that locked it has unlocked it.
+// unlocking NULL (no block) does nothing.
+
+void BlockCache::lock(unsigned char* data){
+	locks[(data - this->data[0]) / cache_block_size]++;
+}
+
+void BlockCache::unlock(unsigned char* data){
+	if (data) locks[(data - this->data[0]) / cache_block_size]--;
+}
+
+unsigned long BlockCache::getHits(unsigned char slot){
+	return hits[slot];
+}
+
+unsigned long BlockCache::getMisses(unsigned char slot){
+	return misses[slot];
+}
+
+int BlockCache::lookup(uint32_t file, uint32_t block){
+	if (file == 0) return -1;
+
+	for (unsigned char i = 0; i < cache_blocks; i++) {
+		if (this->file[i] == file && this->block[i] == block) return i;
+	}
+	return -1;
+}
+
+// read a block into a free slot, or else the least recently used one that
+// isn't locked. returns the slot, or -1.
+//
+// a contiguous file's block is read straight from the card. if the block
+// before it on the card was the last one read, the card is still sending,
+// and the block simply follows (a multi-block read). otherwise it's read as
+// a whole, aligned block through SdFile, which the sd library copies straight
+// from the card too, but only after following the cluster chain to it.
+
+int BlockCache::load(CachedFile* sd_file, uint32_t block){
+	int slot = -1;
+	unsigned int age = 0;
+
+	if (sd_file->firstCluster() == 0) return -1;
+
+	for (unsigned char i = 0; i < cache_blocks; i++) {
+		if (locks[i]) continue;
+		if (file[i] == 0) {
+			slot = i;
+			break;
+		}
+		if (slot < 0 || (unsigned int) (clock - used[i]) > age) {
+			slot = i;
+			age = clock - used[i];
+		}
+	}
+	if (slot < 0) return -1;
+
+	misses[slot]++;
+	file[slot] = 0;
+
+	STAT(unsigned long started = micros();)
+	int got = -1;
+	uint32_t raw = card ? sd_file->cardBlock(block) : 0;
+
+	if (raw) {
+		if (raw != reading) {
+			stop();
+			if (card->readStart(raw)) reading = raw;
+		}
+		if (reading == raw && card->readData(data[slot])) {
+			reading++;
+			uint32_t left = sd_file->fileSize() - block * cache_block_size;
+			got = left < cache_block_size ? left : cache_block_size;
+		}
+		else {
+			stop();
+		}
+	}
+	if (got < 0) {
+		stop();
+		if (sd_file->SdFile::seekSet(block * cache_block_size)) {
+			got = sd_file->SdFile::read(data[slot], cache_block_size);
+		}
+	}
+	STAT(stats.sdRead(micros() - started);)
+	if (got <= 0) return -1;
+
+	file[slot] = sd_file->firstCluster();
+	this->block[slot] = block;
+	len[slot] = got;
+	return slot;
+}
+
+// the clock wraps, but only the difference to it matters.
+
+void BlockCache::touch(int slot){
+	used[slot] = ++clock;
+}
@@ -0,0 +1,75 @@
+/*
+ * Arduino Library for VS10XX Decoder & FatFs
+ * (c) 2010, David Sirkin sirkin@stanford.edu
+ */
+
+#ifndef BLOCKCACHE_H
+#define BLOCKCACHE_H
+
+#include <SongConfig.h>
+#include <CachedFile.h>
+
+// the block cache holds whole 512 byte blocks of song files, for everything
+// that reads them: the stream buffer, which sends them to the decoder, and
+// the tag and frame scanners (through CachedFile). a block that one of them
+// has read is there for the others, e.g. the frame a seek found is the first
+// one played. blocks are read whole and aligned, which the sd library hands
+// straight to us, without a copy through its own (single) block cache.
+//
+// a block is known by its file's first cluster and its number in the file,
+// so it stays valid after the file is closed: the end of a song still goes
+// out from here after the next one has taken over its SdFile. only song
+// files go through the cache; they're never written to.
+//
+// each player's stream locks the block it's sending from, so it can't be
+// taken from under it (two players on the same song may lock the same one).
+// when the least recently used unlocked block is wanted back, it
+// is read again. with more than one block, the stream reads ahead into the
+// others while it sends from the locked one. teensy 2.0 only has room for the
+// one block the stream buffer's ring used to take, which still saves the
+// copies and the split reads, but nothing is read ahead. cache_blocks is set
+// in SongConfig.h.
+//
+// blocks of a contiguous file (see CachedFile.h) are read from the card by
+// number. blocks that follow each other on the card, e.g. a stream fill and
+// its read-ahead, go out as one multi-block read, which stop() ends.
+
+#define cache_block_size 512
+
+class BlockCache
+{
+  public:
+	BlockCache();
+	void begin(Sd2Card* card);
+	unsigned char* get(CachedFile* sd_file, uint32_t block, unsigned int* len);
+	unsigned char* find(uint32_t file, uint32_t block, unsigned int* len);
+	bool readAhead(CachedFile* sd_file, uint32_t block);
+	void lock(unsigned char* data);
+	void unlock(unsigned char* data);
+	void stop();
+	unsigned long getHits(unsigned char slot);
+	unsigned long getMisses(unsigned char slot);
+  private:
+	int lookup(uint32_t file, uint32_t block);
+	int load(CachedFile* sd_file, uint32_t block);
+	void touch(int slot);
+
+	unsigned char data[cache_blocks][cache_block_size];
+	uint32_t file[cache_blocks];   // first cluster of the block's file, 0 if free
+	uint32_t block[cache_blocks];  // block number within the file
+	unsigned int len[cache_blocks];  // bytes in the block, less at the end of a file
+	unsigned int used[cache_blocks]; // clock at the last use, for lru
+	unsigned int clock;
+	Sd2Card* card;
+	uint32_t reading;              // next block of a multi-block read, or 0
+	unsigned char locks[cache_blocks]; // streams sending from the block
+
+	// per block: lookups it answered, and reads from microsd into it.
+
+	unsigned long hits[cache_blocks];
+	unsigned long misses[cache_blocks];
+};
+
+extern BlockCache block_cache;
+
+#endif
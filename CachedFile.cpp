@@ -0,0 +1,85 @@
+#include <string.h>
+#include <SD.h>
+#include <CachedFile.h>
+#include <BlockCache.h>
+
+CachedFile::CachedFile(){
+	position = 0;
+	first_block = 0;
+	last_block = 0;
+}
+
+uint8_t CachedFile::open(SdFile* dir, const char* name, uint8_t oflag){
+	position = 0;
+	if (!SdFile::open(dir, name, oflag)) return false;
+	find_blocks();
+	return true;
+}
+
+uint8_t CachedFile::open(SdFile* dir, uint16_t index, uint8_t oflag){
+	position = 0;
+	if (!SdFile::open(dir, index, oflag)) return false;
+	find_blocks();
+	return true;
+}
+
+// find out if the file just opened is contiguous. that follows its cluster
+// chain through the fat once, instead of every time a cluster is read.
+
+void CachedFile::find_blocks(){
+	if (!contiguousRange(&first_block, &last_block)) {
+		first_block = 0;
+		last_block = 0;
+	}
+}
+
+// copy from the cached blocks, reading them in as needed. if the cache has
+// no room (the stream buffer has its only block locked), read from the card
+// the usual way. returns the number of bytes read, or -1 on an error.
+
+int16_t CachedFile::read(void* buf, uint16_t nbyte){
+	unsigned char* dst = (unsigned char*) buf;
+	uint16_t done = 0;
+
+	while (done < nbyte) {
+		unsigned int len;
+		unsigned int off = position % cache_block_size;
+		unsigned char* data = block_cache.get(this, position / cache_block_size, &len);
+
+		if (data == NULL) {
+			block_cache.stop();
+			if (!SdFile::seekSet(position)) break;
+			int16_t got = SdFile::read(dst + done, nbyte - done);
+			if (got < 0) break;
+			position += got;
+			return done + got;
+		}
+		if (off >= len) break;
+
+		unsigned int n = len - off;
+		if (n > (unsigned int) (nbyte - done)) n = nbyte - done;
+		memcpy(dst + done, data + off, n);
+		position += n;
+		done += n;
+	}
+	block_cache.stop();
+	return (done == 0 && nbyte > 0 && position < fileSize()) ? -1 : done;
+}
+
+uint8_t CachedFile::seekSet(uint32_t pos){
+	if (!isOpen() || pos > fileSize()) return false;
+	position = pos;
+	return true;
+}
+
+uint32_t CachedFile::curPosition(){
+	return position;
+}
+
+// where the file's block numbered block is on the card, or 0 if the file
+// isn't contiguous (block 0 of the card never belongs to a file).
+
+uint32_t CachedFile::cardBlock(uint32_t block){
+	if (first_block == 0 || block > last_block - first_block) return 0;
+	return first_block + block;
+}
@@ -0,0 +1,41 @@
+/*
+ * Arduino Library for VS10XX Decoder & FatFs
+ * (c) 2010, David Sirkin sirkin@stanford.edu
+ */
+
+#ifndef CACHEDFILE_H
+#define CACHEDFILE_H
+
+#include <SD.h>
+
+// a song file, read through the block cache (see BlockCache.h). it keeps its
+// own position, and reads and seeks go to the cache instead of the card, so
+// that the tag and frame scanners share the blocks the stream buffer plays
+// from. everything else (open, close, fileSize, ...) is the plain SdFile's.
+//
+// these aren't virtual in SdFile, so the file has to be passed around as a
+// CachedFile for its reads to go through the cache.
+//
+// most songs are written to the card in one piece. that's checked when the
+// file is opened, and then the cache reads its blocks straight from the card
+// by their block numbers, without SdFile following the file's cluster chain.
+
+class CachedFile : public SdFile
+{
+  public:
+	CachedFile();
+	uint8_t open(SdFile* dir, const char* name, uint8_t oflag);
+	uint8_t open(SdFile* dir, uint16_t index, uint8_t oflag);
+	int16_t read(void* buf, uint16_t nbyte);
+	uint8_t seekSet(uint32_t pos);
+	uint32_t curPosition();
+	uint32_t cardBlock(uint32_t block);
+  private:
+	void find_blocks();
+
+	uint32_t position;
+	uint32_t first_block;        // the file's first block on the card, if
+	uint32_t last_block;         // it's contiguous, else 0
+};
+
+#endif
@@ -0,0 +1,84 @@
+#include <SD.h>
+#include <Fader.h>
+
+// the decoder's level for each percent, (int) (e^(percent / 100.0) * 93.8).
+
+static const unsigned char levels[max_volume + 1] PROGMEM = {
+   93,  94,  95,  96,  97,  98,  99, 100, 101, 102,  // 0%
+  103, 104, 105, 106, 107, 108, 110, 111, 112, 113,  // 10%
+  114, 115, 116, 118, 119, 120, 121, 122, 124, 125,  // 20%
+  126, 127, 129, 130, 131, 133, 134, 135, 137, 138,  // 30%
+  139, 141, 142, 144, 145, 147, 148, 150, 151, 153,  // 40%
+  154, 156, 157, 159, 160, 162, 164, 165, 167, 169,  // 50%
+  170, 172, 174, 176, 177, 179, 181, 183, 185, 187,  // 60%
+  188, 190, 192, 194, 196, 198, 200, 202, 204, 206,  // 70%
+  208, 210, 212, 215, 217, 219, 221, 223, 226, 228,  // 80%
+  230, 233, 235, 237, 240, 242, 244, 247, 249, 252,  // 90%
+  254  // 100%
+};
+
+Fader::Fader(){
+	from = 0;
+	to = 0;
+	level = 0;
+	ms = 0;
+	started = 0;
+	active = false;
+}
+
+uint8_t Fader::toLevel(uint8_t percent){
+	if (percent > max_volume) percent = max_volume;
+	return pgm_read_byte(&levels[percent]);
+}
+
+// the highest percent whose level isn't above level: the percent the level
+// came from, if it came from toLevel().
+
+uint8_t Fader::toPercent(uint8_t level){
+	uint8_t percent = 0;
+
+	while (percent < max_volume && pgm_read_byte(&levels[percent + 1]) <= level) {
+		percent++;
+	}
+	return percent;
+}
+
+// fade from one level to another over ms milliseconds, starting at now. a
+// fade that's under way is dropped; start this one from the level it got to.
+
+void Fader::begin(uint8_t from, uint8_t to, unsigned int ms, unsigned long now){
+	this->from = from;
+	this->to = to;
+	this->ms = ms;
+	level = from;
+	started = now;
+	active = true;
+}
+
+// the level the fade has got to by now. returns true if it's not the one
+// given last time, i.e. the decoder should be set to it. the fade is over
+// once it returns the last level.
+
+bool Fader::step(unsigned long now, uint8_t* level){
+	if (!active) return false;
+
+	unsigned long elapsed = now - started;
+	uint8_t next;
+
+	if (elapsed >= ms) {
+		next = to;
+		active = false;
+	}
+	else {
+		next = from + (long) ((int) to - from) * (long) elapsed / ms;
+	}
+
+	if (next == this->level && active) return false;
+	this->level = next;
+	*level = next;
+	return true;
+}
+
+bool Fader::isActive(){
+	return active;
+}
@@ -0,0 +1,45 @@
+/*
+ * Arduino Library for VS10XX Decoder & FatFs
+ * (c) 2010, David Sirkin sirkin@stanford.edu
+ */
+
+#ifndef FADER_H
+#define FADER_H
+
+#include <stdint.h>
+#include <SongConfig.h>
+
+// volumes are given in percent, and turned into the decoder's volume level
+// (0=min, 254=max) with a table: level = e^(percent / 100) * 93.8, as it
+// always was, but worked out ahead of time, so no floating point is needed.
+// the table only ever goes up, so a level is turned back into the percent it
+// came from exactly.
+//
+// a fader moves the level from one value to another over a number of ms, in
+// a straight line. each level step is the same number of decibels, so that
+// sounds even. changing the volume in one jump clicks, so every change is
+// faded, even if only over volume_ramp_ms. the fade lengths are set in
+// SongConfig.h.
+
+#define max_volume        100    // percent
+
+class Fader
+{
+  public:
+	Fader();
+	static uint8_t toLevel(uint8_t percent);
+	static uint8_t toPercent(uint8_t level);
+
+	void begin(uint8_t from, uint8_t to, unsigned int ms, unsigned long now);
+	bool step(unsigned long now, uint8_t* level);
+	bool isActive();
+  private:
+	uint8_t from;
+	uint8_t to;
+	uint8_t level;                 // the level step() gave last
+	unsigned int ms;
+	unsigned long started;         // millis() when the fade began
+	bool active;
+};
+
+#endif
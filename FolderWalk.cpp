@@ -0,0 +1,89 @@
+#include <SD.h>
+#include <LibraryIndex.h>
+#include <FolderWalk.h>
+
+FolderWalk::FolderWalk(SdFile* root){
+	this->root = root;
+	begin();
+}
+
+// (re)start the walk at the root, folder 0.
+
+void FolderWalk::begin(){
+	dir.close();
+	memset(&here, 0, sizeof(here));
+	memset(here.name, ' ', 11);
+	folder = 0;
+	numbers[0] = 0;
+}
+
+// is this directory entry a folder (a sub-directory) that may hold songs?
+// the . and .. entries don't count.
+
+bool FolderWalk::isFolder(dir_t* p){
+	return p->name[0] != DIR_NAME_DELETED && p->name[0] != '.' && DIR_IS_SUBDIR(p);
+}
+
+// move on to the next folder: the first sub-folder of this one, or failing
+// that, the next sub-folder of the folder above, or of the one above that,
+// and so on. false once there are none left.
+
+bool FolderWalk::next(){
+	if (here.depth < max_folder_depth && enter(getDir(), 0)) return true;
+
+	while (here.depth > 0) {
+		uint16_t after = here.path[here.depth - 1] + 1;
+
+		here.depth--;
+		here.path[here.depth] = 0;
+		SdFile* parent = root;
+		if (here.depth > 0) {
+			if (!LibraryIndex::openFolder(root, &here, &dir)) return false;
+			parent = &dir;
+		}
+		if (enter(parent, after)) return true;
+	}
+	return false;
+}
+
+// go into the first sub-folder of parent (the current folder) at or after
+// entry number from.
+
+bool FolderWalk::enter(SdFile* parent, uint16_t from){
+	dir_t p;
+
+	if (!parent->seekSet((uint32_t) from * sizeof(dir_t))) return false;
+	while (parent->readDir(&p) > 0 && p.name[0] != DIR_NAME_FREE) {
+		if (!isFolder(&p)) continue;
+
+		here.path[here.depth] = parent->curPosition() / sizeof(dir_t) - 1;
+		here.depth++;
+		if (!LibraryIndex::openFolder(root, &here, &dir)) {
+			here.depth--;
+			here.path[here.depth] = 0;
+			return false;
+		}
+		memcpy(here.name, p.name, 11);
+		here.parent = numbers[here.depth - 1];
+		numbers[here.depth] = ++folder;
+		return true;
+	}
+	return false;
+}
+
+unsigned int FolderWalk::getFolder(){
+	return folder;
+}
+
+// the current folder's directory, open.
+
+SdFile* FolderWalk::getDir(){
+	return here.depth > 0 ? &dir : root;
+}
+
+// the current folder's record, without its songs: first_song and song_count
+// are left for the caller, who counts them.
+
+folder_entry* FolderWalk::getEntry(){
+	return &here;
+}
@@ -0,0 +1,42 @@
+/*
+ * Arduino Library for VS10XX Decoder & FatFs
+ * (c) 2010, David Sirkin sirkin@stanford.edu
+ */
+
+#ifndef FOLDERWALK_H
+#define FOLDERWALK_H
+
+#include <SD.h>
+#include <LibraryIndex.h>
+
+// walks the folders on the card depth first: the root, then each of its
+// sub-folders in turn, with everything below it. this is the order the
+// library numbers folders (and so songs) in.
+//
+// only the path to the current folder is kept, as directory entry numbers
+// (see folder_entry), so the walk takes the same ram however many folders
+// there are, and however deep they go. stepping back up reopens the folder
+// above from the root. folders deeper than max_folder_depth are left out.
+
+class FolderWalk
+{
+  public:
+	FolderWalk(SdFile* root);
+	void begin();
+	bool next();
+	unsigned int getFolder();
+	SdFile* getDir();
+	folder_entry* getEntry();
+
+	static bool isFolder(dir_t* p);
+  private:
+	bool enter(SdFile* parent, uint16_t from);
+
+	SdFile* root;
+	SdFile dir;                    // the current folder, unless it's the root
+	folder_entry here;             // its name, depth, parent and path
+	unsigned int folder;           // its number
+	uint16_t numbers[max_folder_depth + 1];  // folder numbers along the path
+};
+
+#endif
@@ -0,0 +1,78 @@
+#include <Mp3Info.h>
+#include <FrameTracker.h>
+
+FrameTracker::FrameTracker(){
+	begin(0);
+}
+
+// start following the data from offset in the file, e.g. the start of the
+// audio, or where a song was seeked to.
+
+void FrameTracker::begin(uint32_t offset){
+	start = offset;
+	pos = offset;
+	next = offset;
+	frame = offset;
+	lost = offset;
+	got = 0;
+	chained = false;
+	mpeg = true;
+}
+
+// len bytes of the song went to the decoder. nearly every call ends at the
+// first compare: the next header isn't in these bytes.
+
+void FrameTracker::sent(const unsigned char* buff, unsigned int len){
+	uint32_t end = pos + len;
+
+	while (mpeg && next < end) {
+		// the header may be split over two calls.
+
+		while (got < 4 && next + got < end) {
+			header[got] = buff[next + got - pos];
+			got++;
+		}
+		if (got < 4) break;
+
+		unsigned int n = Mp3Info::frameLength(header);
+
+		// frames of a song all have the same version, layer and sample rate.
+
+		if (n && chained && (((header[1] ^ last[0]) & 0x1E) || ((header[2] ^ last[1]) & 0x0C))) {
+			n = 0;
+		}
+
+		if (n) {
+			if (chained) frame = next;
+			chained = true;
+			last[0] = header[1];
+			last[1] = header[2];
+			next += n;
+			got = 0;
+		}
+		else {
+			// not a frame: look for one at every byte from here on. the next
+			// candidate's first 3 bytes are the last 3 of this one, which
+			// may have been sent in the last call.
+
+			if (chained) {
+				chained = false;
+				lost = next;
+			}
+			header[0] = header[1];
+			header[1] = header[2];
+			header[2] = header[3];
+			got = 3;
+			next++;
+			if (next - lost > max_sync_search) mpeg = false;
+		}
+	}
+	pos = end;
+}
+
+// the offset of the last frame that was sent, to resume at.
+
+uint32_t FrameTracker::getFrame(){
+	if (!mpeg) return start + ((pos - start) & ~3UL);
+	return frame;
+}
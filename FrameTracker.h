@@ -0,0 +1,45 @@
+/*
+ * Arduino Library for VS10XX Decoder & FatFs
+ * (c) 2010, David Sirkin sirkin@stanford.edu
+ */
+
+#ifndef FRAMETRACKER_H
+#define FRAMETRACKER_H
+
+#include <stdint.h>
+
+// the frame tracker follows the mpeg frames in the song data as it's sent to
+// the decoder, so we always know where the last frame that went out starts.
+// that's where a song is resumed after a power cycle: on a frame boundary,
+// so the decoder never starts in the middle of a frame.
+//
+// each frame's header says how long the frame is, so following them costs a
+// compare per 32 byte chunk, and a header decode per frame. a frame only
+// counts once the frame before it led to it, which weeds out false syncs at
+// the start of a song (there may be junk before the first frame) or after
+// the tracker lost its way. if no frames turn up for max_sync_search bytes,
+// the song isn't mpeg (i.e. it's a wav file), and the position is simply
+// rounded down to a whole (16 bit stereo) sample.
+
+class FrameTracker
+{
+  public:
+	FrameTracker();
+	void begin(uint32_t offset);
+	void sent(const unsigned char* buff, unsigned int len);
+	uint32_t getFrame();
+  private:
+	uint32_t start;                // file offset sending started from
+	uint32_t pos;                  // file offset of the next byte sent
+	uint32_t next;                 // where the next frame header should be
+	uint32_t frame;                // the last frame that counts
+	uint32_t lost;                 // where the search for a frame started
+
+	unsigned char header[4];       // the header at next, as it goes by
+	unsigned char got;             // bytes of it so far
+	unsigned char last[2];         // bytes 1 and 2 of the last good header
+	bool chained;                  // a good frame led to next
+	bool mpeg;                     // cleared if no frames turn up
+};
+
+#endif
@@ -1,39 +1,20 @@
 #include <SD.h>
 #include <Id3Tag.h>
-
-#define FILE_NAMES_START 32 //leave some room for persisting play info (vol, track, etc.)
-#define max_name_len  13
-#define max_num_songs 40
-
-// id3v2 tags have variable-length song titles. that length is indicated in 4
-// bytes within the tag. id3v1 tags also have variable-length song titles, up
-// to 30 bytes maximum, but the length is not indicated within the tag. using
-// 60 bytes here is a compromise between holding most titles and saving sram.
+#include <LibraryIndex.h>
+#include <Stats.h>
 
 //allow file scanning to end early if all tags found
 #define MAX_NUM_TAGS 3
 
-#define BUFF_SIZE 400
-#define max_title_len 60
-#define max_artist_len 30
-#define max_album_len 40
-#define max_year_len 4
-#define max_time_len 10
-
-extern char fn[max_name_len];
-
-// an array to hold the current_song's title in ram. it needs 1 extra char to
-// hold the '\0' that indicates the end of a character string. the song title
-// is found in get_title_from_id3tag().
-
-char title[max_title_len + 1];
-char artist[max_artist_len + 1];
-char album[max_album_len + 1];
-char time[max_time_len + 1];
-
 //enum tagType { ID3v2, ID3v1, None }
 
 Id3Tag::Id3Tag(){
+	clearBuffers();
+	time[0] = '\0';
+	audio_start = 0;
+	audio_end = 0;
+	duration = 0;
+	unsync = false;
 }
 
 char* Id3Tag::getTitle(){
@@ -52,65 +33,212 @@ char* Id3Tag::getTime(){
 	return time;
 }
 
-// this utility function reads id3v1 and id3v2 tags, if any are present, from
-// mp3 audio files. if no tags are found, just use the title of the file. :-|
+uint32_t Id3Tag::getAudioStart(){
+	return audio_start;
+}
 
-void Id3Tag::getId3Tag(SdFile* sd_file, char* value, unsigned char pb[], unsigned char c, int j){
-	uint32_t origPos = sd_file->curPosition();
-	sd_file->seekCur(-j);
-	//Serial.println("getId3Tag");
-	//Serial.println(sd_file->curPosition());
-	// found an id3v2.3 frame! the length is in the next 4 bytes.
-        
-    sd_file->read(pb, 4);
-
-    // only the last of these bytes is likely needed, as it can represent
-    // titles up to 255 characters. but to combine these 4 bytes together
-    // into the single value, we first have to shift each one over to get
-    // it into its correct 'digits' position. 
-
-    unsigned long tl = ((unsigned long) pb[0] << (8 * 3)) +
-                        ((unsigned long) pb[1] << (8 * 2)) +
-                        ((unsigned long) pb[2] << (8 * 1)) + pb[3];
-    tl--;
-    
-    // skip 2 bytes (header flags that we don't use), then read in 1 byte of text encoding. 
-
-    sd_file->read(pb, 2);
-    sd_file->read(&c, 1);
-        
-    // if c=1, the title is in unicode, which uses 2 bytes per character.
-    // skip the next 2 bytes (the byte order mark) and decrement tl by 2.
-        
-    if (c) {
-        sd_file->read(pb, 2);
-        tl -= 2;
-    }
-    // remember that titles are limited to only max_title_len bytes long.
-    
-    if (tl > max_title_len) tl = max_title_len;
-        
-    // read in tl bytes of the title itself. add an 'end-of-string' byte.
-
-    sd_file->read(value, tl);
-	value[tl] = '\0';
-
-	if (value[1] == '\0'){
-		// at odd indices seem to have null terminators so let's get rid of them
-		for(int i = 0; i < tl; i++){
-			if (i % 2 == 1) continue;
-			value[i/2] = value[i];
-			//Serial.print(title[i]);
-		}
-
-		//add a null terminator at the new end of the title
-		value[tl/2] = '\0';
+uint32_t Id3Tag::getAudioEnd(){
+	return audio_end;
+}
+
+uint32_t Id3Tag::getDuration(){
+	return duration;
+}
+
+// the duration isn't part of the tag, it's worked out from the audio (see
+// Mp3Info). time is set to the same duration as text, e.g. "3:07" or "1:02:03".
+
+void Id3Tag::setDuration(uint32_t ms){
+	duration = ms;
+
+	if (ms == 0) {
+		time[0] = '\0';
+		return;
 	}
 
-	//Serial.print("value: ");
-	//Serial.println(value);
-	//Serial.println("END getId3Tag");
-	sd_file->seekSet(origPos);
+	uint32_t seconds = ms / 1000;
+	unsigned int hours = seconds / 3600;
+	unsigned char minutes = (seconds / 60) % 60;
+	unsigned char secs = seconds % 60;
+	unsigned char pos = 0;
+
+	if (hours) {
+		if (hours > 99) hours = 99;
+		if (hours > 9) time[pos++] = '0' + hours / 10;
+		time[pos++] = '0' + hours % 10;
+		time[pos++] = ':';
+		time[pos++] = '0' + minutes / 10;
+	}
+	else if (minutes > 9) {
+		time[pos++] = '0' + minutes / 10;
+	}
+	time[pos++] = '0' + minutes % 10;
+	time[pos++] = ':';
+	time[pos++] = '0' + secs / 10;
+	time[pos++] = '0' + secs % 10;
+	time[pos] = '\0';
+}
+
+// fill in a tag that was scanned earlier (and remembered in the library
+// index), instead of scanning the file again.
+
+void Id3Tag::load(const char* _title, const char* _artist, const char* _album, uint32_t _audio_start, uint32_t _audio_end){
+	strncpy(title, _title, max_title_len);
+	title[max_title_len] = '\0';
+	strncpy(artist, _artist, max_artist_len);
+	artist[max_artist_len] = '\0';
+	strncpy(album, _album, max_album_len);
+	album[max_album_len] = '\0';
+	audio_start = _audio_start;
+	audio_end = _audio_end;
+}
+
+// read a 4 byte big-endian number. id3v2.4 frame sizes, and the tag size in
+// every version, are 'syncsafe': bit 7 (the msb) of each byte is set to 0, so
+// each byte only holds 7 bits of the number.
+
+static uint32_t read_size(unsigned char pb[], bool syncsafe){
+  unsigned char bits = syncsafe ? 7 : 8;
+  return ((uint32_t) pb[0] << (bits * 3)) +
+         ((uint32_t) pb[1] << (bits * 2)) +
+         ((uint32_t) pb[2] << (bits * 1)) + pb[3];
+}
+
+// read n bytes of the tag into buf. where the tag (or the frame being read)
+// is unsynchronised, a 0 was put after every 0xff that could be mistaken for
+// the start of an audio frame; those are dropped again, and more is read to
+// make up for them. returns the number of bytes read.
+
+int Id3Tag::read_tag(CachedFile* sd_file, void* buf, int n){
+  unsigned char* b = (unsigned char*) buf;
+  int len = 0;
+
+  if (!unsync) return sd_file->read(buf, n);
+
+  while (len < n) {
+    int got = sd_file->read(b + len, n - len);
+    if (got <= 0) break;
+
+    int kept = len;
+    for (int i = len; i < len + got; i++) {
+      if (after_ff && b[i] == 0) {
+        after_ff = false;
+        continue;
+      }
+      after_ff = (b[i] == 0xFF);
+      b[kept++] = b[i];
+    }
+    tag_pos += kept - len;
+    len = kept;
+  }
+  return len;
+}
+
+// move on to pos in the tag. an unsynchronised tag's positions only count the
+// bytes that are left once it's resynchronised, so it can only be read through
+// (and only forwards).
+
+bool Id3Tag::seek_tag(CachedFile* sd_file, uint32_t pos){
+  unsigned char skipped[32];
+
+  if (!unsync) return sd_file->seekSet(pos);
+
+  while (tag_pos < pos) {
+    int n = (pos - tag_pos > sizeof(skipped)) ? sizeof(skipped) : pos - tag_pos;
+    if (read_tag(sd_file, skipped, n) != n) return false;
+  }
+  return tag_pos == pos;
+}
+
+// latin-1 text (id3v1, and id3v2 frames in encoding 0) is turned into utf-8 in
+// place, the way everything past ascii is sent on: each byte from 0x80 up
+// becomes two. value holds len bytes of latin-1, and has room for max_len;
+// whatever doesn't fit is cut off at a whole character. returns the new length.
+
+static unsigned char latin1_to_utf8(char* value, unsigned char len, unsigned char max_len){
+  unsigned char in = 0, out = 0;
+
+  for (; in < len; in++) {
+    unsigned char n = ((unsigned char) value[in] < 0x80) ? 1 : 2;
+    if (out + n > max_len) break;
+    out += n;
+  }
+
+  // write from the end backwards, so nothing is overwritten before it's read.
+
+  unsigned char end = out;
+  while (in > 0) {
+    unsigned char c = value[--in];
+    if (c < 0x80) {
+      value[--out] = c;
+    }
+    else {
+      value[--out] = 0x80 | (c & 0x3F);
+      value[--out] = 0xC0 | (c >> 6);
+    }
+  }
+  value[end] = '\0';
+  return end;
+}
+
+// read the text of a frame into value, which holds up to max_len characters.
+// the file is positioned just after the frame header, and size is the length
+// of the frame body. only as much of the body as fits in value is read.
+
+void Id3Tag::read_text(CachedFile* sd_file, char* value, unsigned char max_len, uint32_t size){
+  unsigned char enc;
+  unsigned char pb[2];
+  unsigned char len = 0;
+
+  if (size < 2 || read_tag(sd_file, &enc, 1) != 1) return;
+  size--;
+
+  if (enc == 0 || enc == 3) {
+    // iso-8859-1 or utf-8, which is kept as it is (a multibyte character cut
+    // off at max_len is dropped when the text is written out).
+
+    if (size > max_len) size = max_len;
+    int got = read_tag(sd_file, value, size);
+    if (got > 0) len = got;
+    if (enc == 0) len = latin1_to_utf8(value, len, max_len);
+  }
+  else {
+    // utf-16, 2 bytes per character. enc 1 starts with a byte order mark, enc
+    // 2 is always big-endian. we keep the low byte of each character, which is
+    // right for plain ascii, and use '?' for anything else.
+
+    bool big_endian = (enc == 2);
+    unsigned char chars[16];
+
+    if (enc == 1) {
+      if (size < 2 || read_tag(sd_file, pb, 2) != 2) return;
+      big_endian = (pb[0] == 0xFE);
+      size -= 2;
+    }
+
+    // read the text a few characters at a time, rather than one card read
+    // per character.
+
+    while (size >= 2 && len < max_len) {
+      int n = sizeof(chars);
+      if ((uint32_t) n > size) n = size & ~1;
+      if ((max_len - len) * 2 < n) n = (max_len - len) * 2;
+      if (read_tag(sd_file, chars, n) != n) break;
+
+      for (int i = 0; i < n; i += 2) {
+        unsigned char hi = big_endian ? chars[i] : chars[i + 1];
+        unsigned char lo = big_endian ? chars[i + 1] : chars[i];
+        if (hi == 0 && lo == 0) {
+          size = 0;
+          break;
+        }
+        value[len++] = (hi == 0 && lo < 128) ? lo : '?';
+      }
+      if (size) size -= n;
+    }
+  }
+
+  value[len] = '\0';
 }
 
 void Id3Tag::clearBuffers(){
@@ -119,159 +247,228 @@ void Id3Tag::clearBuffers(){
 	album[0] = '\0';
 }
 
-void Id3Tag::scan(SdFile* sd_file){
-	//Serial.println("Id3Tag::scan()");
-	clearBuffers();
-	int numTagsFound = 0;
+// this utility function reads id3v1 and id3v2 tags, if any are present, from
+// mp3 audio files. if no tags are found, just use the title of the file. :-|
+// name is the file's name, as formatName() gives it.
 
-  unsigned char id3[3];       // pointer to the first 3 characters to read in
+void Id3Tag::scan(CachedFile* sd_file, const char* name){
+  //Serial.println("Id3Tag::scan()");
+  STAT(unsigned long started = micros();)
+  clearBuffers();
+  setDuration(0);
+  audio_start = 0;
+  audio_end = sd_file->fileSize();
+
+  unsigned char header[10];   // the id3v2 tag header, if there is one
 
   // visit http://www.id3.org/id3v2.3.0 to learn all(!) about the id3v2 spec.
-  // move the file pointer to the beginning, and read the first 3 characters.
+  // move the file pointer to the beginning, and read the first 10 characters.
 
   sd_file->seekSet(0);
-  sd_file->read(id3, 3);
-  
-  // if these first 3 characters are 'ID3', then we have an id3v2 tag. if so,
-  // a 'TIT2' (for ver2.3) or 'TT2' (for ver2.2) frame holds the song title.
-  if (id3[0] == 'I' && id3[1] == 'D' && id3[2] == '3') {
-	  //Serial.println("ID3");
-    unsigned char pb[4];       // pointer to the last 4 characters we read in
-    unsigned char c;           // the next 1 character in the file to be read
-    
-    // our first task is to find the length of the (whole) id3v2 tag. knowing
-    // this means that we can look for 'TIT2' or 'TT2' frames only within the
-    // tag's length, rather than the entire file (which can take a while).
-
-    // skip 3 bytes (that we don't use), then read in the last 4 bytes of the
-    // header, which contain the tag's length.
-
-    sd_file->read(pb, 3);
-    sd_file->read(pb, 4);
-    
-    // to combine these 4 bytes together into the single value, we first have
-    // to shift each one over to get it into its correct 'digits' position. a
-    // quirk of the spec is that bit 7 (the msb) of each byte is set to 0.
-    
-    unsigned long v2l = ((unsigned long) pb[0] << (7 * 3)) +
-                        ((unsigned long) pb[1] << (7 * 2)) +
-                        ((unsigned long) pb[2] << (7 * 1)) + pb[3];
-	v2l /= 8; 
-    // we just moved the file pointer 10 bytes into the file, so we reset it.
-    
-    sd_file->seekSet(0);
-
-	//Serial.print("id3 header length: ");
-	//Serial.println(v2l);
-	
-	char buff[BUFF_SIZE+1];
-
-    for(int i = 0; i < v2l; i+=BUFF_SIZE){
-		sd_file->read(buff, BUFF_SIZE);
-		buff[BUFF_SIZE] = 0;
-		for(int j = 0; j < BUFF_SIZE; j++){
-      // read in bytes of the file, one by one, so we can check for the tags.
-      
-      //sd_file->read(&c, 1);
-	  c = buff[j];
-      // keep shifting over previously-read bytes as we read in each new one.
-      // that way we keep testing if we've found a 'TIT2' or 'TT2' frame yet.
-      
-      pb[0] = pb[1];
-      pb[1] = pb[2];
-      pb[2] = pb[3];
-      pb[3] = c;
-
-	  //Serial.print(c);
-
-      if (pb[0] == 'T' && pb[1] == 'I' && pb[2] == 'T' && pb[3] == '2') {
-		  numTagsFound++;
-		  //Serial.println("title");
-		  getId3Tag(sd_file, title, pb, c, BUFF_SIZE-j-1);
-      }
-	  else if (pb[0] == 'T' && pb[1] == 'P' && pb[2] == 'E' && pb[3] == '1') {
-		  numTagsFound++;
-		  //Serial.println("artist");
-		  getId3Tag(sd_file, artist, pb, c, BUFF_SIZE-j-1);
-	  }
-	  else if (pb[0] == 'T' && pb[1] == 'A' && pb[2] == 'L' && pb[3] == 'B') {
-		  numTagsFound++;
-		  //Serial.println("album");
-		  getId3Tag(sd_file, album, pb, c, BUFF_SIZE-j-1);
-		  
-	  }
-	  /*else if (pb[0] == 'T' && pb[1] == 'I' && pb[2] == 'M' && pb[3] == 'E') {
-		  Serial.println("time");
-		  getId3Tag(time, pb, c);
-	  }*/
-      else if (pb[1] == 'T' && pb[2] == 'T' && pb[3] == '2') {
-		  numTagsFound++;
-		  //Serial.println("TT2");
-        // found an id3v2.2 frame! the title's length is in the next 3 bytes,
-        // but we read in 4 then ignore the last, which is the text encoding.
-        
-        sd_file->read(pb, 4);
-        
-        // shift each byte over to get it into its correct 'digits' position. 
-        
-        unsigned long tl = ((unsigned long) pb[0] << (8 * 2)) +
-                           ((unsigned long) pb[1] << (8 * 1)) + pb[2];
-        tl--;
-        
-        // remember that titles are limited to only max_title_len bytes long.
-
-        if (tl > max_title_len) tl = max_title_len;
-
-        // there's no text encoding, so read in tl bytes of the title itself.
-        
-        sd_file->read(title, tl);
-        title[tl] = '\0';
-        break;
-      }
-      else
-      if (sd_file->curPosition() == v2l) {
-		  Serial.println("EOT");
-        // we reached the end of the id3v2 tag. use the file name as a title.
 
-        strncpy(title, fn, max_name_len);
-        break;
-      }
+  // if the first 3 characters are 'ID3', then we have an id3v2 tag.
+
+  if (sd_file->read(header, 10) == 10 &&
+      header[0] == 'I' && header[1] == 'D' && header[2] == '3' &&
+      header[3] >= 2 && header[3] <= 4) {
+    scan_v2(sd_file, header);
+  }
+
+  // look for an id3v1 tag too. it fills in whatever the id3v2 tag (if any)
+  // didn't have, and marks the end of the audio. failing that, use the file
+  // name as a title.
+
+  scan_v1(sd_file);
+  if (title[0] == '\0') {
+    strncpy(title, name, max_name_len);
+  }
+
+  sd_file->seekSet(0);
+  STAT(stats.scanTime(micros() - started);)
+  //Serial.println("exit id3tag");
+}
+
+// walk the frames of an id3v2 tag. each frame starts with a header holding
+// its id and the length of its body. we read the bodies of the frames we want
+// and seek straight past all the others (album art can be hundreds of kb), and
+// stop as soon as we have found all MAX_NUM_TAGS frames we're looking for.
+
+void Id3Tag::scan_v2(CachedFile* sd_file, unsigned char header[]){
+  unsigned char version = header[3];
+  unsigned char flags = header[5];
+  unsigned char pb[10];        // one frame header
+  unsigned char numTagsFound = 0;
+
+  // the tag's size doesn't include its 10 byte header, nor (in id3v2.4, if
+  // the footer flag is set) its 10 byte footer. the audio starts after both.
+
+  uint32_t end = 10 + read_size(header + 6, true);
+  audio_start = end + ((flags & 0x10) ? 10 : 0);
+
+  // an id3v2.2 tag with the compression flag set can't be read at all.
+
+  if (version == 2 && (flags & 0x40)) {
+    return;
+  }
+
+  // in id3v2.2 and id3v2.3, the unsynchronisation flag covers the whole tag,
+  // frame headers and all. (id3v2.4 flags it frame by frame instead.)
+
+  unsync = (version <= 3 && (flags & 0x80));
+  after_ff = false;
+  tag_pos = 10;
+
+  // id3v2.2 frames have 3 character ids and 3 byte sizes. id3v2.3 and id3v2.4
+  // frames have 4 character ids, 4 byte sizes and 2 bytes of flags.
+
+  unsigned char frame_header_len = (version == 2) ? 6 : 10;
+  uint32_t pos = 10;
+
+  // skip the extended header, if there is one. its size doesn't include the
+  // size field itself in id3v2.3, but does in id3v2.4.
+
+  if (version >= 3 && (flags & 0x40)) {
+    if (read_tag(sd_file, pb, 4) != 4) return;
+    pos += (version == 3) ? 4 + read_size(pb, false) : read_size(pb, true);
+  }
+
+  while (numTagsFound < MAX_NUM_TAGS && pos + frame_header_len <= end) {
+    if (!seek_tag(sd_file, pos) || sd_file->curPosition() + frame_header_len > end ||
+        read_tag(sd_file, pb, frame_header_len) != frame_header_len) {
+      break;
     }
-	}
+
+    // a zero byte where a frame id should be means we've reached the padding
+    // at the end of the tag.
+
+    if (pb[0] == 0) {
+      break;
+    }
+
+    uint32_t size;
+    if (version == 2) {
+      size = ((uint32_t) pb[3] << 16) + ((uint32_t) pb[4] << 8) + pb[5];
+    }
+    else {
+      size = read_size(pb + 4, version == 4);
+    }
+
+    if (size > end - pos - frame_header_len) {
+      break;
+    }
+    uint32_t next = pos + frame_header_len + size;
+
+    char* value = 0;
+    unsigned char max_len = 0;
+
+    if ((version == 2 && pb[0] == 'T' && pb[1] == 'T' && pb[2] == '2') ||
+        (version != 2 && pb[0] == 'T' && pb[1] == 'I' && pb[2] == 'T' && pb[3] == '2')) {
+      value = title;
+      max_len = max_title_len;
+    }
+    else if ((version == 2 && pb[0] == 'T' && pb[1] == 'P' && pb[2] == '1') ||
+             (version != 2 && pb[0] == 'T' && pb[1] == 'P' && pb[2] == 'E' && pb[3] == '1')) {
+      value = artist;
+      max_len = max_artist_len;
+    }
+    else if ((version == 2 && pb[0] == 'T' && pb[1] == 'A' && pb[2] == 'L') ||
+             (version != 2 && pb[0] == 'T' && pb[1] == 'A' && pb[2] == 'L' && pb[3] == 'B')) {
+      value = album;
+      max_len = max_album_len;
+    }
+
+    if (value && value[0] == '\0' && read_frame(sd_file, version, pb[9], &size)) {
+      read_text(sd_file, value, max_len, size);
+      numTagsFound++;
+    }
+
+    // an id3v2.4 frame's own unsynchronisation ends with the frame.
+
+    unsync = (version <= 3 && (flags & 0x80));
+
+    pos = next;
   }
-  else {
-    // the file doesn't have an id3v2 tag so search for an id3v1 tag instead.
-    // an id3v1 tag begins with the 3 characters 'TAG'. if these are present,
-    // then they are located exactly 128 bits from the end of the file.
-    
-    sd_file->seekSet(sd_file->fileSize() - 128);
-    sd_file->read(id3, 3);
-    
-    if (id3[0] == 'T' && id3[1] == 'A' && id3[2] == 'G') {
-		Serial.println("TAG");
-      // found it! now read in the full title, which is always 30 bytes long.
-      
-      sd_file->read(title, 30);
-      
-      // strip spaces and non-printable characters from the end of the title.
-      // you may have to expand this range to incorporate unicode characters.
-      
-      for (char i = 30 - 1; i >= 0; i--) {
-        if (title[i] <= ' ' || title[i] > 126) {
-          title[i] = '\0';
-        }
-        else {
-          break;
-        }
+}
+
+// get ready to read the body of a text frame, given the second byte of its
+// flags. what's in front of the text is read past, and size is set to the
+// length of the text. returns false if the text can't be read: the frame is
+// compressed or encrypted.
+//
+// id3v2.3 puts a group id in front of the text if the frame is grouped.
+// id3v2.4 does too, and then a data length indicator (the length of the text
+// once it's resynchronised), and it flags unsynchronisation frame by frame.
+
+bool Id3Tag::read_frame(CachedFile* sd_file, unsigned char version, unsigned char format, uint32_t* size){
+  unsigned char pb[5];
+  unsigned char skip = 0;
+
+  if (version == 3) {
+    if (format & 0xC0) return false;
+    if (format & 0x20) skip = 1;
+  }
+  else if (version == 4) {
+    if (format & 0x0C) return false;
+    if (format & 0x40) skip = 1;
+    if (format & 0x01) skip += 4;
+    if (format & 0x02) {
+      unsync = true;
+      after_ff = false;
+    }
+  }
+
+  if (*size < skip || read_tag(sd_file, pb, skip) != skip) return false;
+  *size -= skip;
+  if (version == 4 && (format & 0x01)) {
+    *size = read_size(pb + skip - 4, true);
+  }
+  return true;
+}
+
+// an id3v1 tag is the last 128 bytes of the file, and begins with the 3
+// characters 'TAG'. the title, artist and album follow, 30 bytes each. only
+// the fields that are still empty are filled in.
+
+void Id3Tag::scan_v1(CachedFile* sd_file){
+  unsigned char id3[3];
+  char field[31];
+
+  if (sd_file->fileSize() < 128) return;
+
+  sd_file->seekSet(sd_file->fileSize() - 128);
+  if (sd_file->read(id3, 3) != 3 || id3[0] != 'T' || id3[1] != 'A' || id3[2] != 'G') {
+    return;
+  }
+  //Serial.println("TAG");
+
+  audio_end = sd_file->fileSize() - 128;
+
+  char* values[3] = { title, artist, album };
+  unsigned char max_lens[3] = { max_title_len, max_artist_len, max_album_len };
+
+  for (unsigned char v = 0; v < 3; v++) {
+    if (sd_file->read(field, 30) != 30) return;
+    field[30] = '\0';
+
+    // strip spaces and control characters from the end of the field. the
+    // text is latin-1, so anything from 0xA0 up is a letter or sign.
+
+    for (signed char i = 30 - 1; i >= 0; i--) {
+      unsigned char c = field[i];
+      if (c <= ' ' || (c >= 0x7F && c < 0xA0)) {
+        field[i] = '\0';
+      }
+      else {
+        break;
       }
     }
-    else {
-      // we reached the end of the id3v1 tag. use the file name as a title.
-      
-      strncpy(title, fn, max_name_len);
+
+    // the latin-1 text fits, since max_title_len, max_artist_len and
+    // max_album_len are >= 30; as utf-8 it may not, and is cut short.
+
+    if (values[v][0] == '\0') {
+      strcpy(values[v], field);
+      latin1_to_utf8(values[v], strlen(field), max_lens[v]);
     }
   }
-  
-  sd_file->seekSet(0);
-  //Serial.println("exit id3tag");
-}
\ No newline at end of file
+}
@@ -1,20 +1,70 @@
 #ifndef ID3TAG_H
 #define ID3TAG_H
 
+#include <SongConfig.h>
+#include <CachedFile.h>
+
+// id3v2 tags have variable-length song titles. that length is indicated in 4
+// bytes within the tag. id3v1 tags also have variable-length song titles, up
+// to 30 bytes maximum, but the length is not indicated within the tag. using
+// 60 bytes (see SongConfig.h) is a compromise between holding most titles and
+// saving sram.
+
+#define max_year_len 4
+#define max_time_len 10
+
 class Id3Tag
 {
   public:
 	Id3Tag();
-	void scan(SdFile* sd_file);
+	void scan(CachedFile* sd_file, const char* name);
+	void load(const char* title, const char* artist, const char* album, uint32_t audio_start, uint32_t audio_end);
 
 	char* getTitle();
 	char* getArtist();
 	char* getAlbum();
 	char* getTime();
 	char* getTag(const char* tag);
+	uint32_t getAudioStart();
+	uint32_t getAudioEnd();
+	uint32_t getDuration();
+	void setDuration(uint32_t ms);
   private:
-	void getId3Tag(SdFile* sd_file, char* value, unsigned char pb[], unsigned char c, int j);
+	void scan_v2(CachedFile* sd_file, unsigned char header[]);
+	void scan_v1(CachedFile* sd_file);
+	bool read_frame(CachedFile* sd_file, unsigned char version, unsigned char format, uint32_t* size);
+	void read_text(CachedFile* sd_file, char* value, unsigned char max_len, uint32_t size);
+	int read_tag(CachedFile* sd_file, void* buf, int n);
+	bool seek_tag(CachedFile* sd_file, uint32_t pos);
 	void clearBuffers();
+
+	// each tag holds its own strings, so that the next song's tag can be read
+	// while the current one is still playing. each needs 1 extra char to hold
+	// the '\0' that indicates the end of a character string.
+
+	char title[max_title_len + 1];
+	char artist[max_artist_len + 1];
+	char album[max_album_len + 1];
+	char time[max_time_len + 1];
+
+	// the audio is everything between the id3v2 tag at the start of the file
+	// and the id3v1 tag at the end, if either is there. audio_start is the
+	// offset of its first byte, audio_end of the byte just past its last.
+
+	uint32_t audio_start;
+	uint32_t audio_end;
+
+	// how long the song plays, in milliseconds (0 if we don't know). time
+	// holds the same, as text.
+
+	uint32_t duration;
+
+	// while scanning an unsynchronised tag (or frame): whether the last byte
+	// read was 0xff, and how far into the tag we are once it's resynchronised.
+
+	bool unsync;
+	bool after_ff;
+	uint32_t tag_pos;
 };
 
 #endif
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include <JsonHandler.h>
+#include <Stats.h>
 #include <HardwareSerial.h>
 #include <SD.h>
 
@@ -6,98 +7,365 @@
 
 HardwareSerial Uart = HardwareSerial();
 
-#define UART_BUFFER_SIZE 50
-
-char response[200];
-
-JsonHandler::JsonHandler(){
+JsonHandler::JsonHandler() : writer(send, this) {
+	tx_in = 0;
+	uart_done = 0;
+	may_wait = true;
+	msg_active = false;
+	msg_droppable = false;
+	msg_dropped = false;
+	next_droppable = false;
+	msg_start = 0;
+	prog_queued = false;
+	prog_start = 0;
+	prog_len = 0;
+	tx_queued = 0;
+	tx_sent = 0;
+	tx_dropped = 0;
+	parse_state = READ_CMD;
+	source = NULL;
+	len = 0;
+	cmd[0] = '\0';
+	data[0] = '\0';
+	callback = NULL;
 }
 
 void JsonHandler::setup(){
-	Uart.begin(9600);       // start Uart communication at 9600bps
+	Uart.begin(uart_baud);  // start Uart communication at 9600bps
 }
 
 bool JsonHandler::inputAvailable(){
  return Uart.available() || Serial.available(); 
 }
 
-void JsonHandler::readChar(char &c){
-  if(Uart.available()){
-    c = Uart.read();
+// call this as often as you like (e.g. every loop()): it takes what has
+// arrived so far, at most max_bytes_per_read bytes, and never waits for more.
+// it returns true when a whole command has come in, which getCommand() and
+// getData() then hold until the next call. if a callback was set with
+// onCommand(), it's called with the command as well.
+
+bool JsonHandler::readCommand(){
+  for (unsigned char n = 0; n < max_bytes_per_read; n++) {
+    // a frame is read from one port to the end, so that commands coming in
+    // on both ports at once don't get mixed up.
+
+    if (source == NULL) {
+      if (Uart.available()) source = &Uart;
+      else if (Serial.available()) source = &Serial;
+      else return false;
+    }
+    if (!source->available()) return false;
+
+    if (parse(source->read())) {
+      source = NULL;
+      if (callback != NULL) callback(cmd, data);
+      return true;
+    }
   }
-  if(Serial.available()){
-    c = Serial.read();
-  }  
+  return false;
 }
 
-void JsonHandler::readCommand(char* buffer, char* data){
-  bool dataInfo = false;
-  int i = 0;
-  
-  //wait a some time to allow the input stream to buffer so we can read whole commands in.
-  delay(UART_BUFFER_SIZE);
+// the same, but copies the command into buffer (at least max_cmd_len + 1
+// chars) and its data into data (at least max_data_len + 1 chars). returns
+// true if a whole command came in. if not, both are left empty, so sketches
+// that check buffer[0] (this used to return nothing) don't see the last
+// command again.
 
-  while(inputAvailable()){
-    char inChar;
-    readChar(inChar);
-    if (inChar == END_CMD_CHAR){
-      return; 
-    }
-    if(!dataInfo){
-      if (inChar == ','){
-        i=0;
-        dataInfo=true; 
-        continue;
-      }
-      buffer[i] = inChar;  
-      i++;
-      if( i > UART_BUFFER_SIZE ){
-        buffer[i-1] = '\0';
-        Uart.print("Command too long.");
+bool JsonHandler::readCommand(char* buffer, char* data){
+  if (!readCommand()) {
+    buffer[0] = '\0';
+    data[0] = '\0';
+    return false;
+  }
+  strcpy(buffer, cmd);
+  strcpy(data, this->data);
+  return true;
+}
+
+void JsonHandler::onCommand(command_callback callback){
+  this->callback = callback;
+}
+
+bool JsonHandler::hasCallback(){
+  return callback != NULL;
+}
+
+char* JsonHandler::getCommand(){
+  return cmd;
+}
+
+char* JsonHandler::getData(){
+  return data;
+}
+
+// feed one byte to the frame parser. returns true when c completes a frame.
+// line endings are ignored, so commands can be typed in a serial monitor.
+
+bool JsonHandler::parse(char c){
+  if (c == '\r' || c == '\n') return false;
+
+  // the first byte of a frame clears out the previous command.
+
+  if (parse_state == READ_CMD && len == 0) {
+    cmd[0] = '\0';
+    data[0] = '\0';
+  }
+
+  if (c == END_CMD_CHAR) {
+    bool complete = (parse_state != DISCARD);
+    parse_state = READ_CMD;
+    len = 0;
+
+    if (!complete) {
+      cmd[0] = '\0';
+      data[0] = '\0';
+
+      // a message of its own, through the ring like any other, so it can't
+      // land in the middle of one that's being sent.
+
+      if (writer.getDepth() > 0) {
+        respond();
       }
-      buffer[i] = '\0';
+      addKeyValuePair("message", "Command too long.", true);
+      respond();
     }
-    else{
-      data[i] = inChar;
-      i++;
-      data[i] = '\0';
+    return complete;
+  }
+
+  switch (parse_state) {
+  case READ_CMD:
+    if (c == ',') {
+      parse_state = READ_DATA;
+      len = 0;
     }
+    else if (len < max_cmd_len) {
+      cmd[len++] = c;
+      cmd[len] = '\0';
+    }
+    else {
+      parse_state = DISCARD;
+    }
+    break;
+
+  case READ_DATA:
+    if (len < max_data_len) {
+      data[len++] = c;
+      data[len] = '\0';
+    }
+    else {
+      parse_state = DISCARD;
+    }
+    break;
+
+  case DISCARD:
+    break;
   }
+  return false;
 }
 
+// responses are built with addKeyValuePair(), and go out in chunks while
+// they're being built. respond() closes whatever is still open and finishes
+// the message. firstPair opens a new object: the next item of an array opened
+// with beginArray(), or else a new message. a message that was never sent
+// with respond() is finished first, since part of it has already gone out.
+
 void JsonHandler::addKeyValuePair(const char* key, const char* val, bool firstPair){
-  char* appendChars = ",\"";
-  int offset = 1;
-  if (firstPair){
-    strcpy(response, "{}");
-    offset = 0;
-    appendChars = "\"";
+  if (firstPair) {
+    if (writer.getDepth() > 0 && !writer.inArray()) {
+      respond();
+    }
+    writer.beginObject();
   }
-
-  int len = strlen(response);
-  int lenKey = strlen(key);
-  int lenVal = strlen(val);
-  strcpy(response+len-1, appendChars);
-  strcpy(response+len+offset, key);
-  strcpy(response+len+offset+lenKey, "\":\"");
-  strcpy(response+len+offset+lenKey+3, val);
-  strcpy(response+len+offset+lenKey+3+lenVal, "\"}");
-  response[strlen(response)+1] = '\0';
+  writer.add(key, val);
 }
 
 void JsonHandler::addKeyValuePair(const char* key, const char* val){
   addKeyValuePair(key, val, false); 
 }
 
-void JsonHandler::addKeyValuePair(const char* key, int val){
-  char buff[5];
-  itoa(val, buff, 10);
-  addKeyValuePair(key, buff, false); 
+// numbers are sent as strings, which is what clients have always been given.
+
+void JsonHandler::addKeyValuePair(const char* key, long val){
+  writer.add(key, val, true);
+}
+
+void JsonHandler::beginArray(const char* key){
+  writer.beginArray(key);
+}
+
+// close the innermost open object or array.
+
+void JsonHandler::end(){
+  writer.end();
+}
+
+// the next message is a progress update, which may be dropped rather than
+// wait for room in the ring. a message that's still open is finished first.
+
+void JsonHandler::beginProgress(){
+  if (writer.getDepth() > 0) {
+    respond();
+  }
+  next_droppable = true;
+}
+
+// the writer's sink. usb serial isn't held to a baud rate, so it gets
+// everything straight away; the uart's share is queued.
+
+void JsonHandler::send(void* context, const char* buff, unsigned char len){
+  Serial.write((const uint8_t*) buff, len);
+  ((JsonHandler*) context)->queue(buff, len);
+}
+
+// every byte for the uart is counted as queued, and then as sent or dropped
+// (or it's still in the ring): queued = sent + dropped + getTxLevel().
+// bytes are numbered as they go into the ring, and byte n sits at
+// tx[n % tx_depth]; tx_in numbers the next one, tx_sent the next to go out.
+
+void JsonHandler::queue(const char* buff, unsigned char len){
+  if (!msg_active) {
+    start_message();
+  }
+  tx_queued += len;
+  if (msg_dropped) {
+    tx_dropped += len;
+    return;
+  }
+
+  for (unsigned char i = 0; i < len; i++) {
+    if (tx_in - tx_sent == tx_depth && !make_room()) {
+      // no room, and none to be made: the message is taken back out of the
+      // ring, and the rest of it dropped as it comes.
+
+      tx_dropped += (tx_in - msg_start) + len - i;
+      tx_in = msg_start;
+      msg_dropped = true;
+      return;
+    }
+    tx[tx_in % tx_depth] = buff[i];
+    tx_in++;
+  }
+}
+
+// the ring is full. the oldest progress update still waiting in it goes first
+// (there's at most one, since each replaces the last). after that, a progress
+// update gives up itself, as nothing older is droppable; anything else waits
+// for the uart, but only if setWait() allows it.
+
+bool JsonHandler::make_room(){
+  if (drop_progress()) return true;
+  if (msg_droppable || !may_wait) return false;
+  STAT(unsigned long started = micros();)
+  send_byte();
+  STAT(stats.uartBlocked(micros() - started);)
+  return true;
 }
 
+// take the last progress update out of the ring, wherever it is, if none of
+// it has gone out yet. whatever was queued after it moves up to close the gap.
+
+bool JsonHandler::drop_progress(){
+  if (!prog_queued) return false;
+  prog_queued = false;
+  if ((long) (tx_sent - prog_start) > 0) return false;
+
+  for (unsigned long n = prog_start + prog_len; n != tx_in; n++) {
+    tx[(n - prog_len) % tx_depth] = tx[n % tx_depth];
+  }
+  tx_in -= prog_len;
+  if (msg_active && (long) (msg_start - prog_start) > 0) {
+    msg_start -= prog_len;
+  }
+  tx_dropped += prog_len;
+  return true;
+}
+
+// a new progress update replaces the previous one, if that's still waiting:
+// its position is out of date anyway.
+
+void JsonHandler::start_message(){
+  msg_active = true;
+  msg_droppable = next_droppable;
+  msg_dropped = false;
+  msg_start = tx_in;
+
+  if (msg_droppable) {
+    drop_progress();
+  }
+}
+
+void JsonHandler::end_message(){
+  if (msg_active && !msg_dropped && msg_droppable) {
+    prog_queued = true;
+    prog_start = msg_start;
+    prog_len = tx_in - msg_start;
+  }
+  msg_active = false;
+  next_droppable = false;
+}
+
+// whether a message that finds the ring full may wait for the uart to make
+// room. Song allows it only while the decoder isn't playing, as waiting at
+// 9600bps outlasts the decoder's fifo. otherwise the message is dropped.
+
+void JsonHandler::setWait(bool wait){
+  may_wait = wait;
+}
+
+// hand the uart the next byte. uart_done is when it will have sent everything
+// it's been given, counting from now if it's idle.
+
+void JsonHandler::send_byte(){
+  unsigned long now = micros();
+
+  if ((long) (uart_done - now) < 0) {
+    uart_done = now;
+  }
+  Uart.write((uint8_t) tx[tx_sent % tx_depth]);
+  uart_done += tx_byte_us;
+  tx_sent++;
+}
+
+// keep the uart's own buffer topped up to tx_burst bytes. call this often,
+// e.g. every loop() (see Song::loop()): it never waits for the uart.
+
+void JsonHandler::drain(){
+  while (tx_in != tx_sent && (long) (uart_done - micros()) < (long) (tx_burst * tx_byte_us)) {
+    send_byte();
+  }
+}
+
+unsigned int JsonHandler::getTxLevel(){
+  return tx_in - tx_sent;
+}
+
+unsigned long JsonHandler::getTxQueued(){
+  return tx_queued;
+}
+
+unsigned long JsonHandler::getTxSent(){
+  return tx_sent;
+}
+
+unsigned long JsonHandler::getTxDropped(){
+  return tx_dropped;
+}
+
+// send a message that's already been put together. one that's still being
+// built is finished first.
+
 void JsonHandler::respondString(char* data){
-	Uart.print(data);
-	Serial.print(data);
+  if (writer.getDepth() > 0) {
+    respond();
+  }
+  writer.flush();
+  for (size_t len = strlen(data); len > 0; ) {
+    unsigned char n = len > 255 ? 255 : len;
+    send(this, data, n);
+    data += n;
+    len -= n;
+  }
+  end_message();
 }
 
 void JsonHandler::respond(){
@@ -105,11 +373,11 @@ void JsonHandler::respond(){
 }
 
 void JsonHandler::respond(bool endChar){
-	//Serial.println(strlen(response));
-    Serial.println(response);
-	Uart.print(response);
+  writer.endAll();
 	if(endChar){
-		Uart.print(END_CMD_CHAR);
+		writer.raw(END_CMD_CHAR);
 	}
-	response[0] = '\0';
-}
\ No newline at end of file
+  writer.flush();
+  end_message();
+  Serial.println();
+}
@@ -6,6 +6,29 @@
 #ifndef JSONHANDLER_H
 #define JSONHANDLER_H
 
+#include <Stream.h>
+#include <SongConfig.h>
+#include <JsonWriter.h>
+
+// commands arrive as "cmd,data!" frames, over the uart or usb serial. the
+// parser takes them a byte at a time, so reading input never blocks loop().
+// anything longer than max_cmd_len and max_data_len is thrown away, up to
+// the next '!'.
+//
+// max_bytes_per_read is how many bytes one call to readCommand() will take.
+// at 9600bps a byte comes in about every millisecond, so 8 easily keeps up
+// with any loop(). these, and the sizes below, are set in SongConfig.h.
+
+typedef void (*command_callback)(char* cmd, char* data);
+
+// responses for the uart wait in a ring until drain() sends them, a few bytes
+// at a time, so that sending never holds up the decoder. drain() works out how
+// much the uart still has to send at uart_baud, and hands it no more than
+// tx_burst bytes ahead. that's less than the uart's own 40 byte buffer holds,
+// so its write() never has to wait.
+
+#define tx_byte_us  (10000000UL / uart_baud)   // 10 bits per byte, with start and stop
+
 class JsonHandler
 {
   public:
@@ -15,14 +38,69 @@ class JsonHandler
 	void respond(bool endChar);
 	void respondString(char* data);
 	bool inputAvailable();
-	void readCommand(char* buffer, char* data);
+	bool readCommand();
+	bool readCommand(char* buffer, char* data);
+	void onCommand(command_callback callback);
+	bool hasCallback();
+	char* getCommand();
+	char* getData();
 
 	void addKeyValuePair(const char* key, const char* val, bool firstPair);
 	void addKeyValuePair(const char* key, const char* val);
-	void addKeyValuePair(const char* key, int val);
+	void addKeyValuePair(const char* key, long val);
+	void beginArray(const char* key);
+	void end();
+
+	void beginProgress();
+	void drain();
+	void setWait(bool wait);
+	unsigned int getTxLevel();
+	unsigned long getTxQueued();
+	unsigned long getTxSent();
+	unsigned long getTxDropped();
   private:
-	void readChar(char &c);
-	
+	bool parse(char c);
+	static void send(void* context, const char* buff, unsigned char len);
+	void queue(const char* buff, unsigned char len);
+	bool make_room();
+	bool drop_progress();
+	void start_message();
+	void end_message();
+	void send_byte();
+
+	JsonWriter writer;
+
+	char tx[tx_depth];
+	unsigned long tx_in;           // number of the next byte into the ring
+	unsigned long uart_done;       // micros() the uart will have sent it all
+	bool may_wait;                 // see setWait()
+
+	// the message being queued, and the last progress update in the ring. a
+	// progress update is dropped when a newer one comes along, or to make
+	// room, as long as none of it has gone out yet.
+
+	bool msg_active;
+	bool msg_droppable;
+	bool msg_dropped;
+	bool next_droppable;
+	unsigned long msg_start;       // number of its first byte
+	bool prog_queued;
+	unsigned long prog_start;
+	unsigned int prog_len;
+
+	unsigned long tx_queued;       // bytes for the uart, all told
+	unsigned long tx_sent;         // bytes handed to the uart
+	unsigned long tx_dropped;      // bytes thrown away, queued or not
+
+	// where the parser is in the current frame.
+
+	enum { READ_CMD, READ_DATA, DISCARD } parse_state;
+
+	Stream *source;                // the port the current frame comes from
+	unsigned char len;
+	char cmd[max_cmd_len + 1];
+	char data[max_data_len + 1];
+	command_callback callback;
 };
 
 #endif
\ No newline at end of file
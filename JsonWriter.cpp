@@ -0,0 +1,189 @@
+#include <JsonWriter.h>
+
+JsonWriter::JsonWriter(json_sink _sink, void* _context){
+	sink = _sink;
+	context = _context;
+	len = 0;
+	depth = 0;
+	arrays = 0;
+	items = 0;
+	skipped = 0;
+}
+
+unsigned char JsonWriter::getDepth(){
+	return depth;
+}
+
+bool JsonWriter::inArray(){
+	return depth > 0 && (arrays & (1 << (depth - 1)));
+}
+
+// an object (or array) is opened either at the top level, as a new message, or
+// as the next item of whatever is open: with a key inside an object, without
+// one inside an array. one opened past json_max_depth is left out, along with
+// everything in it, and only counted so its end() can be matched up.
+
+void JsonWriter::beginObject(){
+	open('{', NULL);
+}
+
+void JsonWriter::beginObject(const char* key){
+	open('{', key);
+}
+
+void JsonWriter::beginArray(const char* key){
+	open('[', key);
+}
+
+void JsonWriter::open(char c, const char* key){
+	if (skipped > 0 || depth >= json_max_depth) {
+		skipped++;
+		return;
+	}
+	if (depth > 0) name(key);
+
+	uint8_t bit = 1 << depth;
+	if (c == '[') arrays |= bit; else arrays &= ~bit;
+	items &= ~bit;
+	depth++;
+	put(c);
+}
+
+void JsonWriter::end(){
+	if (skipped > 0) {
+		skipped--;
+		return;
+	}
+	if (depth == 0) return;
+	depth--;
+	put((arrays & (1 << depth)) ? ']' : '}');
+}
+
+void JsonWriter::endAll(){
+	skipped = 0;
+	while (depth > 0) end();
+}
+
+// start the next item at the current level: a comma if it isn't the first,
+// then its key (inside an object only). a key/value pair with nothing open
+// starts an object for it.
+
+void JsonWriter::name(const char* key){
+	if (depth == 0) beginObject();
+
+	uint8_t bit = 1 << (depth - 1);
+	if (items & bit) put(',');
+	items |= bit;
+
+	if (key != NULL && !(arrays & bit)) {
+		putString(key);
+		put(':');
+	}
+}
+
+void JsonWriter::add(const char* key, const char* val){
+	if (skipped > 0) return;
+	name(key);
+	putString(val);
+}
+
+void JsonWriter::add(const char* key, long val){
+	add(key, val, false);
+}
+
+// numbers can be sent quoted, as strings, for clients that expect them that way.
+
+void JsonWriter::add(const char* key, long val, bool quoted){
+	if (skipped > 0) return;
+	name(key);
+	if (quoted) put('"');
+	putNumber(val);
+	if (quoted) put('"');
+}
+
+// a byte that isn't part of the json, e.g. the end of command character.
+
+void JsonWriter::raw(char c){
+	put(c);
+}
+
+// the bytes c takes up in a string, once escaped (see putString()).
+
+unsigned char JsonWriter::charLength(char c){
+	unsigned char u = c;
+
+	if (u == '"' || u == '\\') return 2;
+	if (u < 0x20 || u == 0x7F) return 6;
+	return 1;
+}
+
+void JsonWriter::flush(){
+	if (len > 0) sink(context, chunk, len);
+	len = 0;
+}
+
+void JsonWriter::put(char c){
+	if (len == json_chunk_size) flush();
+	chunk[len++] = c;
+}
+
+// quotes and backslashes are escaped, and so are control characters. bytes
+// past ascii are passed through as they are: the text is utf-8 (Id3Tag turns
+// latin-1 tags into it). a multibyte character that was cut short at the end
+// of a buffer is left out, so the message stays valid utf-8.
+
+void JsonWriter::putString(const char* s){
+	static const char hex[] = "0123456789abcdef";
+
+	put('"');
+	for (; *s; s++) {
+		unsigned char c = *s;
+
+		if (c >= 0xC0) {
+			// a lead byte: check its continuation bytes are all there.
+			unsigned char n = (c >= 0xF0) ? 3 : (c >= 0xE0) ? 2 : 1;
+			unsigned char i = 1;
+			while (i <= n && (s[i] & 0xC0) == 0x80) i++;
+			if (i <= n) {
+				s += i - 1;
+				continue;
+			}
+		}
+		if (c == '"' || c == '\\') {
+			put('\\');
+			put(c);
+		}
+		else if (c < 0x20 || c == 0x7F) {
+			put('\\');
+			put('u');
+			put('0');
+			put('0');
+			put(hex[c >> 4]);
+			put(hex[c & 15]);
+		}
+		else {
+			put(c);
+		}
+	}
+	put('"');
+}
+
+// digits are worked out backwards into a buffer big enough for any long,
+// including a 64-bit one (the host build's).
+
+void JsonWriter::putNumber(long val){
+	char digits[20];
+	unsigned char n = 0;
+	unsigned long u = val;
+
+	if (val < 0) {
+		put('-');
+		u = 0 - u;
+	}
+	do {
+		digits[n++] = '0' + u % 10;
+		u /= 10;
+	} while (u > 0);
+
+	while (n > 0) put(digits[--n]);
+}
@@ -0,0 +1,59 @@
+/*
+ * Arduino Library for VS10XX Decoder & FatFs
+ * (c) 2010, David Sirkin sirkin@stanford.edu
+ */
+
+#ifndef JSONWRITER_H
+#define JSONWRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <SongConfig.h>
+
+// the json writer builds a message front to back, and hands it to a sink in
+// small chunks as it goes, so a message (e.g. the whole library) never has to
+// fit in sram at once. it keeps track of which objects and arrays are open,
+// and where commas go, and escapes strings on the way through. it collects
+// json_chunk_size bytes before calling the sink, and keeps track of up to
+// json_max_depth open objects and arrays (see SongConfig.h).
+
+typedef void (*json_sink)(void* context, const char* buff, unsigned char len);
+
+class JsonWriter
+{
+  public:
+	JsonWriter(json_sink sink, void* context);
+	void beginObject();
+	void beginObject(const char* key);
+	void beginArray(const char* key);
+	void end();
+	void endAll();
+	unsigned char getDepth();
+	bool inArray();
+
+	void add(const char* key, const char* val);
+	void add(const char* key, long val);
+	void add(const char* key, long val, bool quoted);
+
+	void raw(char c);
+	void flush();
+	static unsigned char charLength(char c);
+  private:
+	void open(char c, const char* key);
+	void name(const char* key);
+	void put(char c);
+	void putString(const char* s);
+	void putNumber(long val);
+
+	json_sink sink;
+	void* context;
+	char chunk[json_chunk_size];
+	unsigned char len;
+
+	unsigned char depth;
+	uint8_t arrays;              // bit n set: level n is an array, not an object
+	uint8_t items;               // bit n set: level n already has an item
+	unsigned char skipped;       // opened past json_max_depth, and left out
+};
+
+#endif
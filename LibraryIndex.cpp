@@ -0,0 +1,240 @@
+#include <SD.h>
+#include <LibraryIndex.h>
+
+LibraryIndex::LibraryIndex(){
+	header.count = 0;
+	header.folders = 0;
+	failed = false;
+	header.generation = 0;
+}
+
+// open (or create) the index file in the root directory and read its header.
+// a missing, foreign or older index simply counts as empty, and is rebuilt.
+// so is one whose records have other tag lengths (see SongConfig.h). returns
+// false if there's no index file, and it can't be created either (the card
+// is write protected, or full).
+
+bool LibraryIndex::begin(SdFile* root){
+	file.close();
+	folder_file.close();
+	header.count = 0;
+	header.folders = 0;
+	header.generation = 0;
+	failed = false;
+	if (!file.open(root, index_file_name, O_RDWR | O_CREAT) ||
+	    !folder_file.open(root, folder_file_name, O_RDWR | O_CREAT)) {
+		file.close();
+		folder_file.close();
+		return false;
+	}
+
+	if (file.read(&header, sizeof(header)) != sizeof(header) ||
+	    header.magic != index_magic || header.version != index_version ||
+	    header.entry_size != (uint8_t) sizeof(index_entry)) {
+		header.magic = index_magic;
+		header.version = index_version;
+		header.count = 0;
+		header.entry_size = sizeof(index_entry);
+		header.checksum = 0;
+		header.folders = 0;
+		header.generation = 0;
+
+		// records are written in order, right after the header. sd_file can't
+		// seek past its end, so the header has to be there first.
+
+		file.seekSet(0);
+		if (file.write(&header, sizeof(header)) != sizeof(header)) failed = true;
+	}
+	return true;
+}
+
+// the index is up to date if it describes the same songs, in the same order,
+// as the directory does right now. that's decided by the checksum alone, so
+// a warm boot doesn't have to read a single record.
+
+bool LibraryIndex::matches(unsigned int count, uint32_t checksum){
+	return file.isOpen() && header.count == count && header.checksum == checksum;
+}
+
+unsigned int LibraryIndex::getCount(){
+	return header.count;
+}
+
+unsigned int LibraryIndex::getFolderCount(){
+	return header.folders;
+}
+
+unsigned int LibraryIndex::getGeneration(){
+	return header.generation;
+}
+
+uint32_t LibraryIndex::offset(unsigned int song){
+	return sizeof(index_header) + (uint32_t) song * sizeof(index_entry);
+}
+
+bool LibraryIndex::read(unsigned int song, index_entry* entry){
+	if (song >= header.count || !file.seekSet(offset(song))) return false;
+	return file.read(entry, sizeof(index_entry)) == sizeof(index_entry);
+}
+
+bool LibraryIndex::write(unsigned int song, index_entry* entry){
+	if (!file.seekSet(offset(song)) ||
+	    file.write(entry, sizeof(index_entry)) != sizeof(index_entry)) {
+		failed = true;
+		return false;
+	}
+	return true;
+}
+
+// called once every record has been checked (and rewritten where needed):
+// store the new header, and drop any records past the end of the library.
+// if any of it couldn't be written (say the card is write protected), the
+// index is closed and reads as empty, since its records can't be trusted.
+// this is the only place the index changes, so it's where its generation does.
+
+bool LibraryIndex::finish(unsigned int count, unsigned int folders, uint32_t checksum){
+	header.count = count;
+	header.folders = folders;
+	header.checksum = checksum;
+
+	uint16_t generation = checksum ^ (checksum >> 16);
+	if (generation == header.generation) generation++;
+	header.generation = generation ? generation : 1;
+
+	if (failed || !file.seekSet(0) ||
+	    file.write(&header, sizeof(header)) != sizeof(header) ||
+	    !file.truncate(offset(count)) || !file.sync() ||
+	    !folder_file.truncate((uint32_t) folders * sizeof(folder_entry)) ||
+	    !folder_file.sync()) {
+		file.close();
+		folder_file.close();
+		header.count = 0;
+		header.folders = 0;
+		header.generation = 0;
+		return false;
+	}
+	return true;
+}
+
+// folder records are written as the folders are walked, before finish()
+// stores how many there are, so these don't check against that count.
+
+bool LibraryIndex::readFolder(unsigned int folder, folder_entry* entry){
+	if (!folder_file.seekSet((uint32_t) folder * sizeof(folder_entry))) return false;
+	return folder_file.read(entry, sizeof(folder_entry)) == sizeof(folder_entry);
+}
+
+// only write a folder record if it changed, so that walking an unchanged card
+// doesn't write to it.
+
+bool LibraryIndex::writeFolder(unsigned int folder, folder_entry* entry){
+	folder_entry old;
+
+	if (readFolder(folder, &old) && memcmp(&old, entry, sizeof(folder_entry)) == 0) {
+		return true;
+	}
+	if (!folder_file.seekSet((uint32_t) folder * sizeof(folder_entry)) ||
+	    folder_file.write(entry, sizeof(folder_entry)) != sizeof(folder_entry)) {
+		failed = true;
+		return false;
+	}
+	return true;
+}
+
+// open a folder (not the root) into dir, by following its path down from the
+// root. the directories on the way are opened in turn, in dir and one other
+// SdFile, picked so that the folder itself ends up in dir.
+
+bool LibraryIndex::openFolder(SdFile* root, folder_entry* entry, SdFile* dir){
+	SdFile tmp;
+	SdFile *from = root;
+
+	dir->close();
+	for (unsigned char i = 0; i < entry->depth; i++) {
+		SdFile *to = ((entry->depth - i) % 2 == 1) ? dir : &tmp;
+
+		if (!to->open(from, entry->path[i], O_READ)) {
+			if (from != root) from->close();
+			return false;
+		}
+		if (from != root) from->close();
+		from = to;
+	}
+	return entry->depth > 0;
+}
+
+// fold a song's directory entry into the running checksum of the directory.
+// the name, first cluster, size and write stamp all change when a song is
+// replaced, renamed or edited.
+
+uint32_t LibraryIndex::dir_checksum(uint32_t checksum, dir_t* p){
+	unsigned char key[23];
+
+	memcpy(key, p->name, 11);
+	memcpy(key + 11, &p->firstClusterHigh, 2);
+	memcpy(key + 13, &p->firstClusterLow, 2);
+	memcpy(key + 15, &p->fileSize, 4);
+	memcpy(key + 19, &p->lastWriteDate, 2);
+	memcpy(key + 21, &p->lastWriteTime, 2);
+
+	for (unsigned char i = 0; i < sizeof(key); i++) {
+		checksum = (checksum << 5) + (checksum >> 27) + key[i];
+	}
+	return checksum;
+}
+
+// true if entry was made from the same file that p describes.
+
+bool LibraryIndex::describes(index_entry* entry, dir_t* p){
+	return memcmp(entry->name, p->name, 11) == 0 &&
+	       entry->cluster == (((uint32_t) p->firstClusterHigh << 16) | p->firstClusterLow) &&
+	       entry->size == p->fileSize &&
+	       entry->date == p->lastWriteDate &&
+	       entry->time == p->lastWriteTime;
+}
+
+void LibraryIndex::setFile(index_entry* entry, dir_t* p){
+	memcpy(entry->name, p->name, 11);
+	entry->reserved = 0;
+	entry->folder = 0;
+	entry->dir_index = 0;
+	entry->cluster = ((uint32_t) p->firstClusterHigh << 16) | p->firstClusterLow;
+	entry->size = p->fileSize;
+	entry->date = p->lastWriteDate;
+	entry->time = p->lastWriteTime;
+}
+
+void LibraryIndex::setTag(index_entry* entry, Id3Tag* tag){
+	strncpy(entry->title, tag->getTitle(), max_title_len);
+	entry->title[max_title_len] = '\0';
+	strncpy(entry->artist, tag->getArtist(), max_artist_len);
+	entry->artist[max_artist_len] = '\0';
+	strncpy(entry->album, tag->getAlbum(), max_album_len);
+	entry->album[max_album_len] = '\0';
+	entry->audio_start = tag->getAudioStart();
+	entry->audio_end = tag->getAudioEnd();
+	entry->duration = tag->getDuration();
+}
+
+void LibraryIndex::getTag(index_entry* entry, Id3Tag* tag){
+	tag->load(entry->title, entry->artist, entry->album, entry->audio_start, entry->audio_end);
+	tag->setDuration(entry->duration);
+}
+
+// turn an 8.3 name as stored in a dir_t (space padded, no '.') into a file
+// name that sd_file.open() understands, e.g. "SONG    MP3" -> "SONG.MP3".
+
+void LibraryIndex::formatName(const char* name, char* fn){
+	unsigned char pos = 0;
+
+	for (unsigned char i = 0; i < 8; i++) {
+		if (name[i] != ' ') fn[pos++] = name[i];
+	}
+	if (name[8] != ' ') {
+		fn[pos++] = '.';
+		for (unsigned char i = 8; i < 11; i++) {
+			if (name[i] != ' ') fn[pos++] = name[i];
+		}
+	}
+	fn[pos] = '\0';
+}
@@ -0,0 +1,111 @@
+/*
+ * Arduino Library for VS10XX Decoder & FatFs
+ * (c) 2010, David Sirkin sirkin@stanford.edu
+ */
+
+#ifndef LIBRARYINDEX_H
+#define LIBRARYINDEX_H
+
+#include <SD.h>
+#include <Id3Tag.h>
+
+// the library index is a file on the microsd card that remembers, for every
+// song, what sd_dir_setup() would otherwise have to find out by opening the
+// song and scanning its tag: the tags themselves and where the audio starts.
+// each record also holds the directory entry's name, first cluster, size and
+// write stamp, so that a record can be checked against the card cheaply.
+//
+// songs can be in sub-directories (folders). a second file holds a record
+// for every folder, with the path to it from the root as directory entry
+// numbers, so it can be opened without looking up any names. each song's
+// record says which folder it's in, and its entry number there. folders are
+// numbered in the order FolderWalk visits them, and a folder's songs are
+// numbered one after the other.
+//
+// the header's generation changes whenever the index is rewritten, so a
+// client that kept a copy of the library can tell whether it's still good.
+// it's worked out from the checksum, so that a copy of another card's
+// library (or of this one, before the index was rebuilt) is unlikely to pass
+// for this one. 0 means there's no index, and nothing should be kept.
+
+#define index_file_name  "SONGS.IDX"
+#define folder_file_name "FOLDERS.IDX"
+#define index_magic      0x58444953UL   // 'SIDX', little-endian
+#define index_version    5
+#define max_index_songs  0xFFFF  // songs are numbered with 16 bits
+#define max_folders      0xFFFF  // and so are folders
+#define max_folder_depth 8       // folders nested deeper than this are left out
+#define max_name_len     13      // an 8.3 name as a string, see formatName()
+
+struct index_header {
+	uint32_t magic;
+	uint8_t  version;
+	uint8_t  entry_size;           // sizeof(index_entry), as far as 8 bits go
+	uint16_t count;                // number of records that follow
+	uint32_t checksum;             // dir_checksum() of the songs' dir entries
+	uint16_t folders;              // number of records in the folder file
+	uint16_t generation;           // changes every time the library does
+};
+
+struct index_entry {
+	char     name[11];             // 8.3 name, space padded, as in dir_t
+	uint8_t  reserved;
+	uint16_t folder;               // the folder the song is in
+	uint16_t dir_index;            // its entry number in the folder
+	uint32_t cluster;              // first cluster of the file
+	uint32_t size;
+	uint16_t date;                 // last write date and time
+	uint16_t time;
+	uint32_t audio_start;          // first byte after the id3v2 tag
+	uint32_t audio_end;            // first byte of the id3v1 tag, or size
+	uint32_t duration;             // in milliseconds, 0 if unknown
+	char     title[max_title_len + 1];
+	char     artist[max_artist_len + 1];
+	char     album[max_album_len + 1];
+};
+
+// the root directory is folder 0, at depth 0.
+
+struct folder_entry {
+	char     name[11];             // 8.3 name, as in dir_t
+	uint8_t  depth;                // folders between it and the root
+	uint16_t parent;               // the folder it's in
+	uint16_t first_song;
+	uint16_t song_count;
+	uint16_t path[max_folder_depth];  // entry numbers, from the root down
+};
+
+class LibraryIndex
+{
+  public:
+	LibraryIndex();
+	bool begin(SdFile* root);
+	bool matches(unsigned int count, uint32_t checksum);
+	unsigned int getCount();
+	unsigned int getFolderCount();
+	unsigned int getGeneration();
+
+	bool read(unsigned int song, index_entry* entry);
+	bool write(unsigned int song, index_entry* entry);
+	bool finish(unsigned int count, unsigned int folders, uint32_t checksum);
+
+	bool readFolder(unsigned int folder, folder_entry* entry);
+	bool writeFolder(unsigned int folder, folder_entry* entry);
+	static bool openFolder(SdFile* root, folder_entry* entry, SdFile* dir);
+
+	static uint32_t dir_checksum(uint32_t checksum, dir_t* p);
+	static bool describes(index_entry* entry, dir_t* p);
+	static void setFile(index_entry* entry, dir_t* p);
+	static void setTag(index_entry* entry, Id3Tag* tag);
+	static void getTag(index_entry* entry, Id3Tag* tag);
+	static void formatName(const char* name, char* fn);
+  private:
+	uint32_t offset(unsigned int song);
+
+	SdFile file;
+	SdFile folder_file;
+	index_header header;
+	bool failed;                   // a write didn't make it to the card
+};
+
+#endif
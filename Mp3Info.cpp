@@ -0,0 +1,283 @@
+#include <SD.h>
+#include <Mp3Info.h>
+
+// bitrates in kbps / 8 (they're all multiples of 8), indexed by the header's
+// 4 bit bitrate index. index 0 ('free') and 15 (invalid) aren't supported.
+
+static const unsigned char bitrates[5][16] PROGMEM = {
+  { 0, 4,  8, 12, 16, 20, 24, 28, 32, 36, 40, 44, 48, 52, 56, 0 },  // mpeg 1, layer 1
+  { 0, 4,  6,  7,  8, 10, 12, 14, 16, 20, 24, 28, 32, 40, 48, 0 },  // mpeg 1, layer 2
+  { 0, 4,  5,  6,  7,  8, 10, 12, 14, 16, 20, 24, 28, 32, 40, 0 },  // mpeg 1, layer 3
+  { 0, 4,  6,  7,  8, 10, 12, 14, 16, 18, 20, 22, 24, 28, 32, 0 },  // mpeg 2/2.5, layer 1
+  { 0, 1,  2,  3,  4,  5,  6,  7,  8, 10, 12, 14, 16, 18, 20, 0 }   // mpeg 2/2.5, layer 2 & 3
+};
+
+static const unsigned int sample_rates[3] = { 44100, 48000, 32000 };
+
+static uint32_t read_be32(unsigned char b[]){
+  return ((uint32_t) b[0] << 24) + ((uint32_t) b[1] << 16) +
+         ((uint32_t) b[2] << 8) + b[3];
+}
+
+Mp3Info::Mp3Info(){
+	valid = false;
+	has_toc = false;
+	duration = 0;
+}
+
+bool Mp3Info::isValid(){
+	return valid;
+}
+
+uint32_t Mp3Info::getDuration(){
+	return duration;
+}
+
+// check a 4 byte frame header, and if it's good, fill in version, layer, etc.
+// with match set, the header must also have the same version, layer and
+// sample rate as the first frame, which weeds out most false syncs.
+
+bool Mp3Info::parse_header(unsigned char h[], bool match){
+  if (h[0] != 0xFF || (h[1] & 0xE0) != 0xE0) return false;
+
+  unsigned char v = (h[1] >> 3) & 3;
+  unsigned char l = 4 - ((h[1] >> 1) & 3);
+  unsigned char b = h[2] >> 4;
+  unsigned char s = (h[2] >> 2) & 3;
+
+  if (v == 1 || l == 4 || b == 0 || b == 15 || s == 3) return false;
+  if (match && ((h[1] ^ first[1]) & 0x1E || (h[2] ^ first[2]) & 0x0C)) return false;
+
+  version = v;
+  layer = l;
+  mono = (h[3] >> 6) == 3;
+
+  unsigned char table = (version == 3) ? layer - 1 : (layer == 1 ? 3 : 4);
+  kbps = pgm_read_byte(&bitrates[table][b]) * 8;
+
+  // mpeg 2 halves the mpeg 1 sample rates, and mpeg 2.5 quarters them.
+
+  sample_rate = sample_rates[s] >> (version == 3 ? 0 : (version == 2 ? 1 : 2));
+
+  samples = (layer == 1) ? 384 : ((layer == 3 && version != 3) ? 576 : 1152);
+  frame_len = frameLength(h);
+  return true;
+}
+
+// the length in bytes of the frame whose header is h, or 0 if h isn't a frame
+// header we can use. it keeps nothing, so it can follow the frames of a song
+// as they're sent (see FrameTracker.h) while info describes the song.
+
+unsigned int Mp3Info::frameLength(unsigned char h[]){
+  if (h[0] != 0xFF || (h[1] & 0xE0) != 0xE0) return 0;
+
+  unsigned char v = (h[1] >> 3) & 3;
+  unsigned char l = 4 - ((h[1] >> 1) & 3);
+  unsigned char b = h[2] >> 4;
+  unsigned char s = (h[2] >> 2) & 3;
+  unsigned char pad = (h[2] >> 1) & 1;
+
+  if (v == 1 || l == 4 || b == 0 || b == 15 || s == 3) return 0;
+
+  unsigned char table = (v == 3) ? l - 1 : (l == 1 ? 3 : 4);
+  unsigned int kbps = pgm_read_byte(&bitrates[table][b]) * 8;
+  unsigned int rate = sample_rates[s] >> (v == 3 ? 0 : (v == 2 ? 1 : 2));
+
+  if (l == 1) {
+    return (12000UL * kbps / rate + pad) * 4;
+  }
+  unsigned int samples = (l == 3 && v != 3) ? 576 : 1152;
+  return (samples / 8) * 1000UL * kbps / rate + pad;
+}
+
+// find the next frame sync at or after pos, but before limit. a candidate only
+// counts if another frame header follows right where it says it ends. returns
+// the offset of the frame, or audio_end if there isn't one (before limit).
+
+uint32_t Mp3Info::find_sync(CachedFile* sd_file, uint32_t pos, uint32_t limit){
+  unsigned char buff[36];
+  unsigned char h[4];
+
+  if (limit > audio_end) limit = audio_end;
+
+  while (pos + 4 <= limit) {
+    if (!sd_file->seekSet(pos)) break;
+    int got = sd_file->read(buff, sizeof(buff));
+    if (got < 4) break;
+
+    for (unsigned char i = 0; i + 4 <= (unsigned char) got; i++) {
+      if (buff[i] != 0xFF || !parse_header(buff + i, valid)) continue;
+
+      uint32_t next = pos + i + frame_len;
+      if (next + 4 > audio_end) return pos + i;
+
+      uint32_t here = pos + i;
+      if (sd_file->seekSet(next) && sd_file->read(h, 4) == 4 && parse_header(h, valid)) {
+        // parse_header() just described the second frame; describe the first.
+        sd_file->seekSet(here);
+        sd_file->read(h, 4);
+        parse_header(h, false);
+        return here;
+      }
+    }
+
+    // the last 3 bytes might be the start of a header that didn't fit.
+    pos += got - 3;
+  }
+  return audio_end;
+}
+
+// read the first frame of the song, and work out its duration. the song must
+// be mpeg audio; for anything else (e.g. a wav file) this returns false, and
+// offsetAt() won't be able to help.
+
+bool Mp3Info::analyze(CachedFile* sd_file, uint32_t audio_start, uint32_t _audio_end){
+  valid = false;
+  has_toc = false;
+  duration = 0;
+  frames = 0;
+  audio_end = _audio_end;
+
+  first_frame = find_sync(sd_file, audio_start, audio_start + max_sync_search);
+  if (first_frame >= audio_end) return false;
+
+  sd_file->seekSet(first_frame);
+  sd_file->read(first, 4);
+  parse_header(first, false);
+  bytes = audio_end - first_frame;
+
+  if (!read_xing(sd_file)) {
+    read_vbri(sd_file);
+  }
+
+  // the duration is frames * samples / sample_rate seconds. in milliseconds,
+  // frame_ms is the length of one frame, in 256ths of a millisecond.
+
+  if (frames) {
+    uint32_t frame_ms = (uint32_t) samples * 256000UL / sample_rate;
+    duration = (frames >> 8) * frame_ms + (((frames & 0xFF) * frame_ms) >> 8);
+  }
+  else {
+    // no frame count, so assume a constant bitrate: bytes * 8 / kbps.
+    duration = (bytes / kbps) * 8 + ((bytes % kbps) * 8) / kbps;
+  }
+
+  valid = true;
+  return true;
+}
+
+// a xing header (or 'Info', for cbr files) follows the side information in
+// the first frame. it holds flags saying which of the frame count, byte count
+// and table of contents follow.
+
+bool Mp3Info::read_xing(CachedFile* sd_file){
+  unsigned char b[8];
+  unsigned char side = (version == 3) ? (mono ? 17 : 32) : (mono ? 9 : 17);
+
+  sd_file->seekSet(first_frame + 4 + side);
+  if (sd_file->read(b, 8) != 8) return false;
+  if (!((b[0] == 'X' && b[1] == 'i' && b[2] == 'n' && b[3] == 'g') ||
+        (b[0] == 'I' && b[1] == 'n' && b[2] == 'f' && b[3] == 'o'))) {
+    return false;
+  }
+
+  unsigned char flags = b[7];
+
+  if (flags & 1) {
+    sd_file->read(b, 4);
+    frames = read_be32(b);
+  }
+  if (flags & 2) {
+    sd_file->read(b, 4);
+    uint32_t n = read_be32(b);
+    if (n && n <= bytes) bytes = n;
+  }
+  if (flags & 4) {
+    has_toc = sd_file->read(toc, 100) == 100;
+  }
+  return true;
+}
+
+// a vbri header (written by fraunhofer's encoder) is always 32 bytes after the
+// first frame's header. its table of contents holds the byte size of each of
+// a number of equal-length stretches of the song. that's turned into a xing
+// style table: the bytes played at each percent of the song's time.
+
+bool Mp3Info::read_vbri(CachedFile* sd_file){
+  unsigned char b[26];
+
+  sd_file->seekSet(first_frame + 4 + 32);
+  if (sd_file->read(b, 26) != 26) return false;
+  if (!(b[0] == 'V' && b[1] == 'B' && b[2] == 'R' && b[3] == 'I')) return false;
+
+  uint32_t n = read_be32(b + 10);
+  if (n && n <= bytes) bytes = n;
+  frames = read_be32(b + 14);
+
+  unsigned int entries = ((unsigned int) b[18] << 8) + b[19];
+  unsigned int scale = ((unsigned int) b[20] << 8) + b[21];
+  unsigned char entry_size = ((unsigned int) b[22] << 8) + b[23];
+
+  if (entries == 0 || entry_size == 0 || entry_size > 4 || !bytes) return true;
+
+  // walk the entries, and each time the running total of entries passes the
+  // next percent of the song, note how far into the bytes we are.
+
+  uint32_t total = 0;
+  unsigned char percent = 0;
+
+  for (unsigned int e = 0; e <= entries && percent < 100; e++) {
+    while (percent < 100 && (uint32_t) percent * entries <= (uint32_t) e * 100) {
+      toc[percent++] = (total / (bytes / 256 + 1));
+    }
+
+    if (e == entries) break;
+
+    uint32_t size = 0;
+    if (sd_file->read(b, entry_size) != entry_size) return true;
+    for (unsigned char i = 0; i < entry_size; i++) {
+      size = (size << 8) + b[i];
+    }
+    total += size * scale;
+  }
+
+  has_toc = (percent == 100);
+  return true;
+}
+
+// the file offset of the frame that plays at (or just after) ms into the song.
+// with a table of contents, we interpolate between its percent entries; for a
+// cbr file, the offset is simply proportional to the time.
+
+uint32_t Mp3Info::offsetAt(CachedFile* sd_file, uint32_t ms){
+  if (!valid) return 0;
+  if (ms >= duration) return audio_end;
+
+  // find_sync() may have parsed other frames since; go back to the first.
+
+  parse_header(first, false);
+  uint32_t offset;
+
+  if (has_toc) {
+    // which percent of the song is ms, and how far (in 256ths) into it.
+
+    unsigned char percent = ms * 100 / duration;
+    uint32_t frac = (ms * 100 % duration) / (duration / 256 + 1);
+
+    uint32_t a = toc[percent];
+    uint32_t b = (percent < 99) ? toc[percent + 1] : 256;
+    uint32_t x = a * 256 + (b - a) * frac;    // in 65536ths of bytes
+
+    offset = (bytes >> 16) * x + (((bytes & 0xFFFF) * x) >> 16);
+  }
+  else {
+    // bytes = ms * kbps / 8, kept from overflowing for long songs.
+    offset = (ms / 8) * kbps + ((ms % 8) * kbps) / 8;
+  }
+
+  // land on a frame sync, not in the middle of a frame.
+
+  offset += first_frame;
+  uint32_t sync = find_sync(sd_file, offset, offset + max_sync_search);
+  return (sync < audio_end) ? sync : offset;
+}
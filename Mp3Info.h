@@ -0,0 +1,65 @@
+/*
+ * Arduino Library for VS10XX Decoder & FatFs
+ * (c) 2010, David Sirkin sirkin@stanford.edu
+ */
+
+#ifndef MP3INFO_H
+#define MP3INFO_H
+
+#include <CachedFile.h>
+
+// mp3 audio is a string of frames, each starting with a 4 byte header that
+// holds its bitrate and sample rate. Mp3Info reads the first frame to work out
+// how long a song plays, and where in the file a given time is. variable
+// bitrate (vbr) files carry a table of contents for that, in a xing (or info)
+// or vbri header in their first frame. constant bitrate (cbr) files don't need
+// one: time and bytes are proportional.
+
+// how far to look for a frame sync, from the start of the audio or from a
+// seek target. a frame is at most 2881 bytes long.
+
+#define max_sync_search 8192
+
+class Mp3Info
+{
+  public:
+	Mp3Info();
+	bool analyze(CachedFile* sd_file, uint32_t audio_start, uint32_t audio_end);
+	bool isValid();
+	uint32_t getDuration();
+	uint32_t offsetAt(CachedFile* sd_file, uint32_t ms);
+	static unsigned int frameLength(unsigned char h[]);
+  private:
+	bool parse_header(unsigned char h[], bool match);
+	uint32_t find_sync(CachedFile* sd_file, uint32_t pos, uint32_t limit);
+	bool read_xing(CachedFile* sd_file);
+	bool read_vbri(CachedFile* sd_file);
+
+	bool valid;
+	bool has_toc;
+
+	uint32_t first_frame;          // offset of the first frame
+	uint32_t audio_end;
+	uint32_t bytes;                // bytes of audio from first_frame on
+	uint32_t frames;               // number of frames, if the file says so
+	uint32_t duration;             // in milliseconds
+
+	unsigned char first[4];        // the first frame's header
+
+	// the parsed fields of the last header that parse_header() accepted.
+
+	unsigned char version;         // 3 = mpeg 1, 2 = mpeg 2, 0 = mpeg 2.5
+	unsigned char layer;           // 1, 2 or 3
+	unsigned char mono;
+	unsigned int kbps;
+	unsigned int sample_rate;
+	unsigned int samples;          // samples per frame
+	unsigned int frame_len;        // bytes in this frame, header included
+
+	// toc[i] is the offset (in 256ths of bytes) where i percent of the song's
+	// time has been played. a vbri table is converted to the same form.
+
+	unsigned char toc[100];
+};
+
+#endif
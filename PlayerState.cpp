@@ -0,0 +1,272 @@
+#include <stddef.h>
+#include <string.h>
+#include <EEPROM.h>
+#include <PlayerState.h>
+#include <Fader.h>
+#include <Stats.h>
+
+#ifdef __AVR__
+#include <avr/eeprom.h>
+#endif
+
+PlayerState::PlayerState(){
+	memset(&shadow, 0, sizeof(shadow));
+	states = 0;
+	base = journal_start;
+	slot = journal_slots - 1;
+	written = 0;
+	committing = false;
+	touched = false;
+	dirty = false;
+	first_change = 0;
+	last_change = 0;
+	commits = 0;
+}
+
+// the check byte is a crc-8 (polynomial 0x07) of the other bytes. unlike a
+// sum, it catches bytes that were swapped or changed in pairs.
+
+uint8_t PlayerState::checksum(player_record* r){
+	uint8_t* b = (uint8_t*) r;
+	uint8_t crc = 0;
+
+	for (unsigned char i = 0; i < offsetof(player_record, check); i++) {
+		crc ^= b[i];
+		for (unsigned char bit = 0; bit < 8; bit++) {
+			crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+		}
+	}
+	return crc;
+}
+
+// a record counts if it was written whole, in this layout, and holds nothing
+// the player can't take: a blank track number or volume, or an unknown
+// state.
+
+bool PlayerState::is_valid(player_record* r){
+	return r->format == record_format && r->check == checksum(r) &&
+	       r->track != 0xFFFF && r->volume != 0xFF && r->state < states;
+}
+
+bool PlayerState::read_slot(unsigned char s, player_record* r){
+	uint8_t* b = (uint8_t*) r;
+	int addr = base + s * sizeof(player_record);
+
+	for (unsigned char i = 0; i < sizeof(player_record); i++) {
+		b[i] = EEPROM.read(addr + i);
+	}
+	return is_valid(r);
+}
+
+// find the newest record in journal number journal (one per player): the
+// valid one whose successor (in slot order) isn't valid, or isn't numbered
+// one past it. without one, carry over the legacy layout (into the first
+// journal only), or failing that, start from the defaults given. states is
+// the number of play states, which a record's state must be one of. returns
+// true if the state was found in eeprom.
+
+bool PlayerState::begin(unsigned char journal, uint8_t volume, uint16_t track, uint8_t state, uint8_t states){
+	player_record r, next;
+	bool found = false;
+
+	this->states = states;
+	base = journal_start + journal * journal_slots * sizeof(player_record);
+
+	bool valid = read_slot(0, &next);
+	player_record first = next;
+	bool first_valid = valid;
+
+	for (unsigned char s = 0; s < journal_slots; s++) {
+		r = next;
+		bool r_valid = valid;
+
+		if (s + 1 < journal_slots) {
+			valid = read_slot(s + 1, &next);
+		}
+		else {
+			next = first;
+			valid = first_valid;
+		}
+
+		if (r_valid && (!valid || next.seq != (uint8_t) (r.seq + 1))) {
+			shadow = r;
+			slot = s;
+			found = true;
+			break;
+		}
+	}
+
+	// a record from before volumes were kept as a percent may hold the
+	// decoder's level (the default, 175, on a first run). it's turned into the
+	// percent it stands for, like a legacy one below.
+
+	if (found && shadow.volume > max_volume) {
+		shadow.volume = Fader::toPercent(shadow.volume);
+	}
+
+	if (!found) {
+		// the legacy cells had no check at all, so each setting is only
+		// taken if it's in range. a volume over 100 is the decoder's level,
+		// as above.
+
+		if (journal == 0 && EEPROM.read(0) == legacy_init_id) {
+			uint8_t b = EEPROM.read(legacy_volume);
+			if (b != 0xFF) volume = b <= max_volume ? b : Fader::toPercent(b);
+			b = EEPROM.read(legacy_track);
+			if (b != 0xFF) track = b;
+			b = EEPROM.read(legacy_state);
+			if (b < states) state = b;
+			found = true;
+		}
+
+		// a position in percent can't be turned into an offset without the
+		// song, so the song starts over.
+
+		shadow.offset = 0;
+		shadow.seq = 0;
+		shadow.volume = volume;
+		shadow.track = track;
+		shadow.state = state;
+		shadow.format = record_format;
+		slot = journal_slots - 1;
+
+		// get it into the journal right away, so next time it's found there.
+
+		commit();
+	}
+	return found;
+}
+
+uint8_t PlayerState::getVolume(){
+	return shadow.volume;
+}
+
+uint16_t PlayerState::getTrack(){
+	return shadow.track;
+}
+
+uint8_t PlayerState::getState(){
+	return shadow.state;
+}
+
+uint32_t PlayerState::getOffset(){
+	return shadow.offset;
+}
+
+// the setters only touch the ram copy. loop() decides when it's written out.
+
+void PlayerState::setVolume(uint8_t volume){
+	if (shadow.volume != volume) {
+		shadow.volume = volume;
+		changed();
+	}
+}
+
+void PlayerState::setTrack(uint16_t track){
+	if (shadow.track != track) {
+		shadow.track = track;
+		changed();
+	}
+}
+
+void PlayerState::setState(uint8_t state){
+	if (shadow.state != state) {
+		shadow.state = state;
+		changed();
+	}
+}
+
+void PlayerState::setOffset(uint32_t offset){
+	if (shadow.offset != offset) {
+		shadow.offset = offset;
+		changed();
+	}
+}
+
+void PlayerState::changed(){
+	touched = true;
+}
+
+bool PlayerState::isDirty(){
+	return dirty || touched;
+}
+
+unsigned long PlayerState::getCommits(){
+	return commits;
+}
+
+// call this every loop(). it starts a commit when it's time to, and writes
+// the record being committed one byte per call, and only once the eeprom has
+// finished the previous byte, so it never waits on the eeprom.
+
+void PlayerState::loop(unsigned long now, bool idle){
+	if (touched) {
+		touched = false;
+		if (!dirty) {
+			dirty = true;
+			first_change = now;
+		}
+		last_change = now;
+	}
+
+	if (committing) {
+#ifdef __AVR__
+		if (!eeprom_is_ready()) return;
+#endif
+		write_next();
+		return;
+	}
+
+	if (dirty && (idle || now - last_change >= state_settle_ms ||
+	              now - first_change >= state_max_wait_ms)) {
+		start_commit();
+	}
+}
+
+// write everything out now, waiting on the eeprom as needed, e.g. at first
+// run, or before the power is cut.
+
+void PlayerState::commit(){
+	touched = false;
+	if (!committing) start_commit();
+	while (write_next());
+}
+
+// snapshot the state into the next slot's record. changes made while it's
+// being written make the state dirty again, for the next commit.
+
+void PlayerState::start_commit(){
+	out = shadow;
+	out.seq = shadow.seq + 1;
+	out.check = checksum(&out);
+	shadow.seq = out.seq;
+
+	slot = (slot + 1) % journal_slots;
+	written = 0;
+	committing = true;
+	dirty = false;
+}
+
+// write the next byte of out, the check byte last. returns false once the
+// record is complete.
+
+bool PlayerState::write_next(){
+	if (!committing) return false;
+
+	// the slot was last written journal_slots commits ago, and mostly with
+	// the same volume and state: a byte that's already right isn't written.
+
+	int addr = base + slot * sizeof(player_record) + written;
+	uint8_t b = ((uint8_t*) &out)[written];
+	if (EEPROM.read(addr) != b) {
+		EEPROM.write(addr, b);
+		STAT(stats.eepromWrite();)
+	}
+
+	if (++written == sizeof(player_record)) {
+		committing = false;
+		commits++;
+		return false;
+	}
+	return true;
+}
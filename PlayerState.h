@@ -0,0 +1,101 @@
+/*
+ * Arduino Library for VS10XX Decoder & FatFs
+ * (c) 2010, David Sirkin sirkin@stanford.edu
+ */
+
+#ifndef PLAYERSTATE_H
+#define PLAYERSTATE_H
+
+#include <stdint.h>
+#include <SongConfig.h>
+
+// the player state (volume, track, play state and position) is remembered in
+// eeprom across power cycles. an eeprom write takes about 3.3 ms, and each
+// cell only takes so many of them, so the state is kept in ram and changes
+// are only written out once things have settled down: when the player is
+// idle, when nothing has changed for state_settle_ms, or at the latest
+// state_max_wait_ms after the first change.
+//
+// the eeprom side is a journal: each commit writes a whole record to the next
+// of journal_slots slots, round robin, so no cell is written more often than
+// every journal_slots commits. the record with the newest sequence number is
+// the current one. a record only counts if its format byte and check byte
+// match and its fields are in range, so one that was cut short by a power
+// loss is skipped, and the one before it used. the journal overlaps where
+// older versions kept their file names, and those bytes mustn't pass as a
+// record either. each player has a journal of its own, right after the one
+// before it. where the journals start, their number of slots and the timings
+// are set in SongConfig.h.
+
+// the layout that came before the journal: one cell per setting, with
+// legacy_init_id in cell 0. it's read once, to carry the state over.
+
+#define legacy_init_id    33
+#define legacy_volume     1
+#define legacy_track      2
+#define legacy_state      3
+#define legacy_position   4
+
+#define record_format     0xC8   // changes with the record's layout (0xC6
+                                 // had an 8 bit track, 0xC7 a percent
+                                 // position)
+
+// the position is the file offset of the frame to resume at (see
+// FrameTracker.h), so a song picks up where it was, to the frame, and
+// without a search. the check byte comes last, since it's written last. the
+// record is 11 bytes, which SongConfig.h counts on to check that the journal
+// fits in eeprom.
+
+struct player_record {
+	uint32_t offset;               // where in the song's file to resume
+	uint16_t track;
+	uint8_t seq;                   // one more than the record before
+	uint8_t volume;                // in percent
+	uint8_t state;
+	uint8_t format;                // record_format
+	uint8_t check;                 // crc-8 of the bytes before it, written last
+};
+
+class PlayerState
+{
+  public:
+	PlayerState();
+	bool begin(unsigned char journal, uint8_t volume, uint16_t track, uint8_t state, uint8_t states);
+
+	uint8_t getVolume();
+	uint16_t getTrack();
+	uint8_t getState();
+	uint32_t getOffset();
+	void setVolume(uint8_t volume);
+	void setTrack(uint16_t track);
+	void setState(uint8_t state);
+	void setOffset(uint32_t offset);
+
+	void loop(unsigned long now, bool idle);
+	void commit();
+	bool isDirty();
+	unsigned long getCommits();
+  private:
+	void changed();
+	bool read_slot(unsigned char slot, player_record* r);
+	void start_commit();
+	bool write_next();
+	bool is_valid(player_record* r);
+	static uint8_t checksum(player_record* r);
+
+	player_record shadow;          // the state as it is now
+	player_record out;             // the record being written
+	uint8_t states;                // a valid record's state is less than this
+	int base;                      // eeprom address of the journal's first slot
+	unsigned char slot;            // slot of the newest record in eeprom
+	unsigned char written;         // bytes of out written so far
+	bool committing;
+
+	bool touched;                  // changed since the last loop()
+	bool dirty;                    // changed since the last commit
+	unsigned long first_change;
+	unsigned long last_change;
+	unsigned long commits;
+};
+
+#endif
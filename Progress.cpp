@@ -0,0 +1,77 @@
+#include <Progress.h>
+
+Progress::Progress(){
+	permille = progress_permille;
+	step_ms = 0;
+	interval = progress_interval;
+	step = 0xFFFFFFFFUL;
+	threshold = 0xFFFFFFFFUL;
+	pending = 0;
+	last_sent = 0;
+}
+
+// how far apart position updates are, in thousandths of the song...
+
+void Progress::setGranularity(unsigned int _permille){
+	permille = _permille ? _permille : 1;
+	step_ms = 0;
+}
+
+// ...or in milliseconds of it. songs whose duration isn't known (wav files)
+// fall back to the permille granularity.
+
+void Progress::setGranularityMs(unsigned int ms){
+	step_ms = ms;
+}
+
+void Progress::setInterval(unsigned int ms){
+	interval = ms;
+}
+
+// work out the byte step for a song of size bytes that plays for duration ms,
+// and the threshold for the first update after played bytes. called when a
+// song starts, and after a seek.
+
+void Progress::startTrack(uint32_t size, uint32_t duration, uint32_t played){
+	if (step_ms && duration) {
+		// bytes per ms in 256ths, which stays in range for songs of up to
+		// four hours or so, then times step_ms.
+
+		uint32_t rate = (size / duration) * 256 + ((size % duration) * 256) / duration;
+		step = (rate >> 8) * step_ms + (((rate & 0xFF) * step_ms) >> 8);
+	}
+	else {
+		step = (size / 1000) * permille + ((size % 1000) * permille) / 1000;
+	}
+	if (step == 0) step = 1;
+
+	threshold = (played / step + 1) * step;
+}
+
+void Progress::mark(unsigned char what){
+	pending |= what;
+}
+
+void Progress::clear(){
+	pending = 0;
+}
+
+// the song played past the threshold: note a position update, and set the
+// next threshold past bytes (a seek may have skipped several steps).
+
+void Progress::passed(uint32_t bytes){
+	pending |= PROGRESS_POSITION;
+	threshold = (bytes / step + 1) * step;
+}
+
+// returns what changed since the last event, if it's time for the next one,
+// and starts collecting again. returns 0 if there's nothing to send yet.
+
+unsigned char Progress::take(unsigned long now){
+	if (!pending || now - last_sent < interval) return 0;
+
+	unsigned char what = pending;
+	pending = 0;
+	last_sent = now;
+	return what;
+}
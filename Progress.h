@@ -0,0 +1,58 @@
+/*
+ * Arduino Library for VS10XX Decoder & FatFs
+ * (c) 2010, David Sirkin sirkin@stanford.edu
+ */
+
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <stdint.h>
+#include <SongConfig.h>
+
+// progress events tell the client how far into the song we are, and what
+// else changed since the last event (the state and the volume). changes are
+// collected as pending bits, and go out together as one event, no more often
+// than every progress_interval milliseconds.
+//
+// how far the song has to play between position updates (the granularity) is
+// turned into a number of bytes when a song starts, so that while it plays,
+// checking for an update is a single compare against a byte threshold. the
+// defaults are progress_permille and progress_interval, in SongConfig.h.
+
+#define PROGRESS_POSITION 1
+#define PROGRESS_STATE    2
+#define PROGRESS_VOLUME   4
+
+class Progress
+{
+  public:
+	Progress();
+	void setGranularity(unsigned int permille);
+	void setGranularityMs(unsigned int ms);
+	void setInterval(unsigned int ms);
+
+	void startTrack(uint32_t size, uint32_t duration, uint32_t played);
+	void mark(unsigned char what);
+	void clear();
+	unsigned char take(unsigned long now);
+
+	// called for every chunk that's played, so it's kept here to be inlined.
+
+	void played(uint32_t bytes) {
+		if (bytes >= threshold) passed(bytes);
+	}
+  private:
+	void passed(uint32_t bytes);
+
+	unsigned int permille;
+	unsigned int step_ms;          // granularity in ms, or 0 to use permille
+	unsigned int interval;
+
+	uint32_t step;                 // bytes between position updates
+	uint32_t threshold;            // bytes played at the next update
+
+	unsigned char pending;
+	unsigned long last_sent;       // millis() of the last event
+};
+
+#endif
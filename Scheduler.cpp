@@ -0,0 +1,94 @@
+#include <SD.h>
+#include <Scheduler.h>
+#include <JsonHandler.h>
+
+Scheduler::Scheduler(){
+	count = 0;
+	next = 0;
+}
+
+// add a task. its slice is cut down to task_budget_us, so that it can always
+// get a turn. returns false if there are max_tasks already.
+
+bool Scheduler::add(const char* name, task_step step, void* context, unsigned int slice_us){
+	if (count == max_tasks) return false;
+
+	task* t = &tasks[count++];
+	t->step = step;
+	t->context = context;
+	t->slice_us = slice_us < task_budget_us ? slice_us : task_budget_us;
+	STAT(t->name = name;)
+	STAT(t->runs = 0;)
+	STAT(t->us = 0;)
+	STAT(t->max_us = 0;)
+	STAT(t->overruns = 0;)
+	return true;
+}
+
+// give the tasks their turns, for as long as the gate lets us and the budget
+// lasts. a task whose slice doesn't fit in the time left has to wait for the
+// next loop(), and so do the ones after it, so it isn't passed over. the gate
+// is asked once: what it allows is how long the decoders can go without us,
+// so the tasks can have that much between them.
+
+void Scheduler::run(task_gate gate){
+	unsigned long room = gate();
+	unsigned long started = micros();
+	unsigned long now = started;
+
+	if (room > task_budget_us) room = task_budget_us;
+
+	for (unsigned char n = 0; n < count; n++) {
+		unsigned long spent = now - started;
+		task* t = &tasks[next];
+
+		if (spent >= room || t->slice_us > room - spent) break;
+		next = (next + 1) % count;
+
+		unsigned long began = now;
+
+		while (t->step(t->context) && (now = micros()) - began < t->slice_us &&
+		       now - started < room);
+		now = micros();
+
+		STAT(unsigned long took = now - began;)
+		STAT(t->runs++;)
+		STAT(t->us += took;)
+		STAT(if (took > t->max_us) t->max_us = took;)
+		STAT(if (took > t->slice_us) t->overruns++;)
+	}
+}
+
+// add each task's runtime to the response being built: its name, its turns,
+// the time it ran in all and its longest turn (in us), and the turns that ran
+// past its slice. only kept with SONG_STATS defined.
+
+void Scheduler::report(JsonHandler* handler){
+#ifdef SONG_STATS
+	handler->beginArray("tasks");
+	for (unsigned char i = 0; i < count; i++) {
+		handler->addKeyValuePair("", tasks[i].name);
+	}
+	handler->end();
+	handler->beginArray("taskRuns");
+	for (unsigned char i = 0; i < count; i++) {
+		handler->addKeyValuePair("", tasks[i].runs);
+	}
+	handler->end();
+	handler->beginArray("taskUs");
+	for (unsigned char i = 0; i < count; i++) {
+		handler->addKeyValuePair("", tasks[i].us);
+	}
+	handler->end();
+	handler->beginArray("taskMaxUs");
+	for (unsigned char i = 0; i < count; i++) {
+		handler->addKeyValuePair("", tasks[i].max_us);
+	}
+	handler->end();
+	handler->beginArray("taskOverruns");
+	for (unsigned char i = 0; i < count; i++) {
+		handler->addKeyValuePair("", tasks[i].overruns);
+	}
+	handler->end();
+#endif
+}
@@ -0,0 +1,63 @@
+/*
+ * Arduino Library for VS10XX Decoder & FatFs
+ * (c) 2010, David Sirkin sirkin@stanford.edu
+ */
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+#include <SongConfig.h>
+#include <Stats.h>
+
+// the scheduler runs the background work that shares loop() with feeding the
+// decoders: indexing, library pages, eeprom commits, commands, and whatever
+// the sketch adds. feeding comes first, always; a task only runs when
+// the decoders have enough to play for its time slice, and never for longer
+// than task_budget_us a loop() in all (see SongConfig.h).
+//
+// a task is a step function, called with the context it was added with. each
+// step should do a small, bounded piece of work, and return true if there's
+// more it could do right away. the task is called again while it says so,
+// until its slice is used up. tasks take turns: each loop() starts with the
+// one after the last that ran.
+//
+// the gate is called once a loop(), before the first task. it feeds the
+// decoders, and returns how long background work may take now, in us, before
+// a decoder could run dry.
+
+typedef bool (*task_step)(void* context);
+typedef unsigned long (*task_gate)();
+
+class JsonHandler;
+
+class Scheduler
+{
+  public:
+	Scheduler();
+	bool add(const char* name, task_step step, void* context, unsigned int slice_us);
+	void run(task_gate gate);
+	void report(JsonHandler* handler);
+  private:
+	struct task {
+		task_step step;
+		void* context;
+		unsigned int slice_us;     // longest the task may run in one turn
+
+		// the per-task runtime report, see report().
+
+#ifdef SONG_STATS
+		const char* name;
+		unsigned long runs;        // turns it was given
+		unsigned long us;          // time it ran, in all
+		unsigned long max_us;      // longest turn
+		unsigned long overruns;    // turns that ran past the slice
+#endif
+	};
+
+	task tasks[max_tasks];
+	unsigned char count;
+	unsigned char next;            // the task whose turn it is
+};
+
+#endif
@@ -16,9 +16,22 @@
 
 #include <mp3.h>
 #include <mp3conf.h>
+#include <SongConfig.h>
 #include <Song.h>
-
-// setup microsd, decoder, and lcd chip pins
+#include <StreamBuffer.h>
+#include <BlockCache.h>
+#include <CachedFile.h>
+#include <LibraryIndex.h>
+#include <Mp3Info.h>
+#include <Progress.h>
+#include <PlayerState.h>
+#include <Scheduler.h>
+#include <Fader.h>
+#include <Stats.h>
+#include <FolderWalk.h>
+
+// setup microsd, decoder, and lcd chip pins. the decoder pins are those of
+// the mp3 library's decoder, which Song() plays through.
 
 #define sd_cs         12         // 'chip select' for microsd card
 #define mp3_cs        21         // 'command chip select' to cs pin
@@ -27,73 +40,94 @@
 #define rst           18         // 'reset' to decoder's reset pin
 #define dreq          19         // 'data request line' to dreq pin
 
-// read_buffer is the amount of data read from microsd, then sent to decoder.
+// song data is read from microsd into the block cache, and from there sent to
+// the decoder by the stream buffer. see BlockCache.h for its size.
 
-#define read_buffer   256        // size of the microsd read buffer
 #define mp3_vol       175        // default volume: 0=min, 254=max
-#define MAX_VOL       254
 
-#define EEPROM_INIT_ID    33
-#define EEPROM_FIRSTRUN 0
-#define EEPROM_VOLUME   1
-#define EEPROM_TRACK    2
-#define EEPROM_STATE    3
-#define EEPROM_POSITION 4
+// the player state is remembered across power cycles in eeprom, through a
+// ram copy that's written out only once things settle (see PlayerState.h).
+
+// the file list is kept in the library index on the microsd card (see
+// LibraryIndex.h), so the number of songs is only limited by the 16 bit song
+// numbers, to max_index_songs.
 
-// file names are 13 bytes max (8 + '.' + 3 + '\0'), and the file list should
-// fit into the eeprom. for example, 13 * 40 = 520 bytes of eeprom are needed
-// to store a list of 40 songs. if you use shorter file names, or if your mcu
-// has more eeprom, you can change these.
+// the next song is opened, and its tag read, once the current song has fewer
+// than prefetch_window bytes (see SongConfig.h) left to read. that leaves the
+// stream buffer and the decoder's fifo (plus this many bytes) to play while
+// we do it.
 
-#define FILE_NAMES_START 32 //leave some room for persisting play info (vol, track, etc.)
-#define max_name_len  13
-#define max_num_songs 30
+// next steps, declare the variables used later to represent microsd objects.
+// they, the library index and the indexing are shared by every player (see
+// Song.h); everything else about a player is in its Song.
 
-// id3v2 tags have variable-length song titles. that length is indicated in 4
-// bytes within the tag. id3v1 tags also have variable-length song titles, up
-// to 30 bytes maximum, but the length is not indicated within the tag. using
-// 60 bytes here is a compromise between holding most titles and saving sram.
+static Sd2Card  card;            // top-level represenation of card
+static SdVolume volume;          // sd partition, not audio volume
+static SdFile   sd_root;         // sd_files are children of sd_root
 
-// if you increase this above 255, look for and change 'for' loop index types
-// so as to not to overflow the unsigned char data type.
+// the players set up so far, in the order they were. served is the last one
+// that read from the card, and reader the one that may this pass (NULL until
+// one has to), see neediest().
 
-#define max_title_len 60
+static Song* players[max_players];
+static unsigned char player_count = 0;
+static unsigned char served = 0;
+static Song* reader = NULL;
 
-// next steps, declare the variables used later to represent microsd objects.
+// store the number of songs (and folders) in the library.
 
-Sd2Card  card;                   // top-level represenation of card
-SdVolume volume;                 // sd partition, not audio volume
-SdFile   sd_root, sd_file;       // sd_file is the child of sd_root
+static unsigned int num_songs = 0;
+static unsigned int num_folders = 0;
 
-// store the number of songs in this directory, and the current song to play.
+static LibraryIndex library;
 
-unsigned char num_songs = 0, current_song = 0;
+// the library index is brought up to date a slice at a time (see
+// start_index()). walker is where the walk is, and index_pos the entry number
+// in its folder. index_songs, index_folders and index_checksum are what the
+// first pass has found so far, and index_first is the first song of the
+// folder it's in. index_song is the song the second pass is at. index_open is
+// false if there's no index to bring up to date, just the card to walk. a
+// slice reads index_slice_entries dir entries (see SongConfig.h).
 
-// an array to hold the current_song's file name in ram. every file's name is
-// stored longer-term in the eeprom. this array is used for sd_file.open().
+enum index_phase {
+  INDEX_WALK, INDEX_UPDATE, INDEX_DONE };
+static index_phase indexing = INDEX_DONE;
 
-char fn[max_name_len];
+static FolderWalk walker(&sd_root);
+static unsigned int index_pos = 0, index_first = 0;
+static unsigned int index_songs = 0, index_folders = 0, index_song = 0;
+static uint32_t index_checksum = 0;
+static bool index_open = false;
 
-Id3Tag tag;
+// folders (sub-directories) are walked and indexed along with the songs in
+// them. sd_dir is the last folder opened, dir_folder says which one that is.
 
-// the program runs as a state machine. the 'state' enum includes the states.
-// 'current_state' is the default as the program starts. add new states here.
+#define no_folder 0xFFFF
 
-enum state { 
-  DIR_PLAY, MP3_PLAY, IDLE };
-state current_state = DIR_PLAY;
-state last_state = DIR_PLAY;
+static SdFile sd_dir;
+static unsigned int dir_folder = no_folder;
 
-bool repeat = true;
+// the background tasks, for every player (see Scheduler.h). the library's own
+// are added by the first player's setup(), with these slices, in us. an index
+// slice reads a block of dir entries, or scans one song's tag.
 
-// you must open any song file that you want to play using sd_file_open prior
-// to fetching song data from the file. you can only open one file at a time.
+static Scheduler tasks;
 
-int mp3Volume = mp3_vol;
+#define index_task_us     4000
+#define library_task_us   2000
+#define state_task_us     500
+#define command_task_us   2000
+#define fade_task_us      200
 
-//positions to keep track of % of song played
-int currPosition = -1;
-uint32_t bytesPlayed = 0;
+// the mp3 library's decoder, for Song().
+
+static void mp3_data(void* context, unsigned char* data, unsigned char len){
+  Mp3.play(data, len);
+}
+
+static void mp3_volume(void* context, unsigned char volume){
+  Mp3.volume(volume);
+}
 
 void Song::sendPlayerState(){
   handler->addKeyValuePair("command", "CONNECTED", true);
@@ -110,7 +144,6 @@ void Song::sendSongInfo(bool first){
   handler->addKeyValuePair("artist", getArtist());
   handler->addKeyValuePair("album", getAlbum());
   handler->addKeyValuePair("songNumber", current_song);
-  //handler->addKeyValuePair("filename", fn);
   //handler->addKeyValuePair("time", getTime());
   handler->addKeyValuePair("position", currPosition);
   handler->addKeyValuePair("state", isPlaying() ? "PLAYING" : "PAUSED" );
@@ -119,33 +152,316 @@ void Song::sendSongInfo(bool first){
 void Song::sd_file_open() {
 
 Serial.println("sd_file_open()");
-	sd_file.close();
+  STAT(unsigned long started = micros();)
+
+  // a song chosen by hand replaces whatever was prefetched to follow the old
+  // one.
+
+  cancel_prefetch();
+  info_ready = false;
+  info_tried = false;
+
+  // a song that's still playing fades out over track_fade_ms before the new
+  // one starts, see start_picked(). it plays on from the spare file until
+  // then, and the new one is opened now, so it can be described right away.
+  // one that has ended (e.g. dir_play() moving on) has nothing to fade, and
+  // a song picked during the fade just takes the place of the one before.
+
+  bool dip = isPlaying() && !pausing && !dipping && !stream.finished();
+  if (dip) {
+    CachedFile *old_file = sd_file;
+    sd_file = next_file;
+    next_file = old_file;
+
+    Id3Tag *old_tag = tag;
+    tag = next_tag;
+    next_tag = old_tag;
+  }
+  sd_file->close();
 
   //reset position
   currPosition = 0;
   bytesPlayed = 0;
 
-  map_current_song_to_fn();
-  sd_file.open(&sd_root, fn, FILE_READ);
+  // a song picked by hand takes the place of the one we left off with. if
+  // it can't be opened yet, index_done() tries again.
+
+  resumed = open_song(current_song, sd_file, tag);
+  if (dip) {
+    dipping = true;
+    fade.begin(volume_level, 0, track_fade_ms, millis());
+  }
+  else if (!dipping) {
+    stream.reset(sd_file, tag->getAudioStart(), tag->getAudioEnd());
+  }
+  player.setOffset(tag->getAudioStart());
+  set_folder(opened_folder);
 
-  // if you prefer to work with the current song index (only) instead of file
-  // names, this version of the open command should also work for you:
-  //sd_file.open(&sd_root, current_song, FILE_READ);
-  tag.scan(&sd_file);
+  // while the old song fades out, its stream may hold the only cached block,
+  // and working out the new one's duration would read the card byte by byte:
+  // start_picked() does that once it has let go.
+
+  if (!dipping) {
+    progress.startTrack(getAudioSize(), getDuration(), 0);
+  }
+  STAT(stats.openTime(micros() - started);)
   sendSongInfo();
 }
 
+// the old song has faded out (or has to make way now): let go of it, and
+// start the song picked, fading it in.
+
+void Song::start_picked() {
+  dipping = false;
+  next_file->close();
+  stream.reset(sd_file, tag->getAudioStart(), tag->getAudioEnd());
+  progress.startTrack(getAudioSize(), getDuration(), 0);
+  fade.begin(volume_level, Fader::toLevel(volume_percent), track_fade_ms, millis());
+}
+
+// open a song, and fill in its tag from the library index. the song is
+// opened by its entry number in its folder, so no names are looked up. the
+// folder last opened is kept open in sd_dir, for the songs after it.
+
+bool Song::open_song(unsigned int song, CachedFile *file, Id3Tag *song_tag) {
+  index_entry entry;
+  folder_entry folder;
+  unsigned int f;
+  SdFile *dir;
+
+  file->close();
+  if (library.read(song, &entry)) {
+    f = entry.folder;
+    dir = open_folder(f, NULL);
+    if (dir == NULL || !file->open(dir, entry.dir_index, FILE_READ)) {
+      return false;
+    }
+
+    // a record that's out of date (the card changed since it was written, and
+    // the index hasn't caught up yet) may lead to some other file.
+
+    if (file->firstCluster() != entry.cluster || file->fileSize() != entry.size) {
+      file->close();
+      return false;
+    }
+    LibraryIndex::getTag(&entry, song_tag);
+  }
+  else {
+    // without an index, find the song's folder by walking the card, then the
+    // song by counting the songs in it, and scan its tag.
+
+    dir_t p;
+    char name[max_name_len];
+    unsigned int n;
+
+    if (!walk_to(no_folder, song, &folder, &f) || (dir = open_folder(f, &folder)) == NULL) {
+      return false;
+    }
+    n = folder.first_song;
+    dir->rewind();
+    do {
+      if (dir->readDir(&p) <= 0 || p.name[0] == DIR_NAME_FREE) {
+        return false;
+      }
+    } while (!is_song(&p) || n++ != song);
+
+    if (!file->open(dir, dir->curPosition() / sizeof(dir_t) - 1, FILE_READ)) {
+      return false;
+    }
+    LibraryIndex::formatName((char*) p.name, name);
+    song_tag->scan(file, name);
+  }
+  opened_folder = f;
+
+  // skip the id3v2 tag. the decoder would only throw it away, and with album
+  // art it can be hundreds of kb of spi traffic before the first sound.
+
+  file->seekSet(song_tag->getAudioStart());
+  return true;
+}
+
+// a folder's record, from the index, or else found by walking the card.
+
+bool Song::read_folder(unsigned int folder, folder_entry *entry) {
+  unsigned int f;
+
+  if (folder < library.getFolderCount() && library.readFolder(folder, entry)) {
+    return true;
+  }
+  return walk_to(folder, 0, entry, &f);
+}
+
+// walk the card the way sd_dir_setup() numbers it, counting songs on the way,
+// to the folder numbered folder, or (if that's no_folder) the one that song
+// is in. that's slow, but it's only needed when there's no index to read.
+
+bool Song::walk_to(unsigned int folder, unsigned int song, folder_entry *entry, unsigned int *number) {
+  FolderWalk walk(&sd_root);
+  dir_t p;
+  unsigned int first = 0, count;
+
+  do {
+    SdFile *dir = walk.getDir();
+
+    count = 0;
+    dir->rewind();
+    while (dir->readDir(&p) > 0 && p.name[0] != DIR_NAME_FREE) {
+      if (is_song(&p)) {
+        count++;
+      }
+    }
+    if (walk.getFolder() == folder ||
+        (folder == no_folder && song >= first && song < first + count)) {
+      *entry = *walk.getEntry();
+      entry->first_song = first;
+      entry->song_count = count;
+      *number = walk.getFolder();
+      return true;
+    }
+    first += count;
+  } while (walk.getFolder() + 1 < max_folders && walk.next());
+  return false;
+}
+
+// the directory of a folder, opened if it isn't already. songs in the root
+// are opened straight from sd_root. entry is the folder's record, if the
+// caller has it already.
+
+SdFile* Song::open_folder(unsigned int folder, folder_entry *entry) {
+  folder_entry record;
+
+  if (folder == 0) {
+    return &sd_root;
+  }
+  if (folder != dir_folder || !sd_dir.isOpen()) {
+    dir_folder = no_folder;
+    if (entry == NULL) {
+      entry = &record;
+      if (!read_folder(folder, entry)) {
+        return NULL;
+      }
+    }
+    if (!LibraryIndex::openFolder(&sd_root, entry, &sd_dir)) {
+      return NULL;
+    }
+    dir_folder = folder;
+  }
+  return &sd_dir;
+}
+
+// make folder the current folder, and remember which songs are in it, for
+// playing just the one folder.
+
+void Song::set_folder(unsigned int folder) {
+  folder_entry entry;
+
+  current_folder = folder;
+  if (read_folder(folder, &entry)) {
+    folder_first = entry.first_song;
+    folder_count = entry.song_count;
+  }
+  else {
+    folder_first = 0;
+    folder_count = num_songs;
+  }
+}
+
+// the song that plays after song: the next one in the library, or in the
+// current folder when only that is played. false if song was the last one,
+// and we're not repeating.
+
+bool Song::following(unsigned int song, unsigned int *next) {
+  unsigned int first = 0, count = num_songs;
+
+  if (folder_play) {
+    first = folder_first;
+    count = folder_count;
+  }
+  if (count == 0) {
+    return false;
+  }
+  if (song >= first && song + 1 < first + count) {
+    *next = song + 1;
+    return true;
+  }
+  if (repeat) {
+    *next = first;
+    return true;
+  }
+  return false;
+}
+
+// play song number songNumber. numbers outside the library are ignored.
+
 void Song::setSong(int songNumber){
+	if (songNumber < 0 || (unsigned int) songNumber >= num_songs) {
+		return;
+	}
 	current_song = songNumber;
 	sd_file_open();
-	EEPROM.write(EEPROM_TRACK, current_song);
+	player.setTrack(current_song);
 }
 
-bool Song::nextFileExists(){
-  if (current_song < (num_songs - 1) || repeat){
-    return true; 
+// open the song that follows the current one, and read its tag, while the
+// current one is still playing. mp3_play() switches over to it without
+// draining the stream buffer, so there's no gap between the two songs.
+
+void Song::prefetch_next(){
+  if (!following(current_song, &next_song)) {
+    return;
+  }
+
+  // if this fails, we'll try again (the slow way) in dir_play() when this
+  // song ends.
+
+  next_ready = open_song(next_song, next_file, next_tag);
+  next_folder = opened_folder;
+}
+
+void Song::cancel_prefetch(){
+  if (next_ready) {
+    next_file->close();
+    next_ready = false;
   }
-  return false;
+}
+
+// the current song has been read to the end, and next_file is ready: make it
+// the current song. the end of the old song is still in the stream buffer's
+// locked block, and the stream simply carries on with the new one after it.
+
+void Song::start_next(){
+  CachedFile *old_file = sd_file;
+  sd_file = next_file;
+  next_file = old_file;
+  next_file->close();
+
+  Id3Tag *old_tag = tag;
+  tag = next_tag;
+  next_tag = old_tag;
+
+  current_song = next_song;
+  next_ready = false;
+  info_ready = false;
+  info_tried = false;
+  if (next_folder != current_folder) {
+    set_folder(next_folder);
+  }
+
+  currPosition = 0;
+  bytesPlayed = 0;
+  progress.startTrack(getAudioSize(), getDuration(), 0);
+  stream.chain(sd_file, tag->getAudioStart(), tag->getAudioEnd());
+
+  handler->addKeyValuePair("message","Next Song", true);
+  sendSongInfo();
+  handler->respond();
+
+  player.setTrack(current_song);
+}
+
+bool Song::nextFileExists(){
+  unsigned int next;
+  return following(current_song, &next);
 }
 
 bool Song::nextFile(){
@@ -154,17 +470,17 @@ bool Song::nextFile(){
 	  return false;
   }
 
-  current_song = (current_song + 1) % num_songs; 
+  following(current_song, &current_song);
   Serial.println(current_song);
   Serial.println(num_songs);
   sd_file_open();
 
-  EEPROM.write(EEPROM_TRACK, current_song);
+  player.setTrack(current_song);
   return true;
 }
 
 bool Song::prevFileExists(){
-  if (current_song > 0){
+  if (current_song > (folder_play ? folder_first : 0)){
     return true; 
   }
   return false;
@@ -178,62 +494,463 @@ bool Song::prevFile(){
   current_song--;
   sd_file_open();
   
-  EEPROM.write(EEPROM_TRACK, current_song);
+  player.setTrack(current_song);
   return true;
 }
-bool seeked;
+// move to the first song of the next (or previous) folder with songs in it.
+
+bool Song::nextFolder(){
+  folder_entry entry;
+
+  for (unsigned int i = 1; i < num_folders; i++) {
+    unsigned int f = (current_folder + i) % num_folders;
+    if (read_folder(f, &entry) && entry.song_count > 0) {
+      setSong(entry.first_song);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Song::prevFolder(){
+  folder_entry entry;
+
+  for (unsigned int i = 1; i < num_folders; i++) {
+    unsigned int f = (current_folder + num_folders - i) % num_folders;
+    if (read_folder(f, &entry) && entry.song_count > 0) {
+      setSong(entry.first_song);
+      return true;
+    }
+  }
+  return false;
+}
+
+// play only the current folder's songs (and repeat them), or the whole
+// library. a song prefetched from outside the folder is dropped.
+
+void Song::setFolderPlay(bool on){
+  folder_play = on;
+  cancel_prefetch();
+}
+
+unsigned int Song::getFolder(){
+  return current_folder;
+}
 
 void Song::mp3_play() {
-  unsigned char bytes[read_buffer]; // buffer to read and send to the decoder
-  unsigned int bytes_to_read;       // number of bytes read from microsd card
+  // top up the stream buffer from microsd when it runs low, then hand the
+  // decoder as many 32 byte chunks as it will take right now. neither step
+  // waits on the other, so a slow card read doesn't stall the decoder (it
+  // has its own fifo to play from) and a full decoder doesn't stall loop().
+  // with more than one player, only the one loop() picked may read.
+
+  if (reader == this && stream.needsFill()) {
+    stream.fill();
+  }
 
-    // send read_buffer bytes to be played. Mp3.play() tracks the index pointer
-  // within the song being played of where to get the next read_buffer bytes.
-  
-  bytes_to_read = sd_file.read(bytes, read_buffer);
-  Mp3.play(bytes, bytes_to_read);
+  unsigned int sent = feed();
 
-  bytesPlayed += bytes_to_read;
+  // the block ran out while the decoder still wanted more. read the next one
+  // now rather than a loop later, unless another player has read this pass:
+  // right after a pause, the last of a block may be all the decoder has to
+  // play from.
 
-  int pos = (bytesPlayed * 100)/getFileSize();
-  if ( pos > currPosition){
-	  currPosition = pos;
-	  handler->addKeyValuePair("command", "SEEK", true);
-	  handler->addKeyValuePair("position", currPosition);
-	  handler->respond();
+  if (sent && (reader == NULL || reader == this) && stream.needsFill() &&
+      digitalRead(dreq_pin)) {
+    reader = this;
+    stream.fill();
+    feed();
   }
 
-  // bytes_to_read should only be less than read_buffer when the song's over.
+  // carry on into the next song as soon as this one is read to the end. this
+  // comes after feeding, so the decoder's fifo is full while start_next()
+  // tells the uart about the new song. where to resume is the new song's
+  // start from now on, not the last frame of the old one.
 
-  if(bytes_to_read < read_buffer) {
-    sd_file.close();
+  if (stream.atEof() && next_ready) {
+    start_next();
+    player.setOffset(stream.getFrame());
+  }
+
+  // the song's over once it has been read to the end and the stream buffer
+  // has been drained into the decoder.
+
+  if (stream.finished() && !dipping) {
+    sd_file->close();
     current_state = IDLE;
   }
 }
 
+// hand the decoder as much as it will take of what's buffered, without
+// reading the card. the scheduler does this between tasks too. returns the
+// number of bytes sent.
+
+unsigned int Song::feed() {
+  unsigned int sent = stream.feed(dreq_pin);
+
+  // while a song picked by hand waits for the old one to fade out, what's
+  // sent is still the old one's.
+
+  if (dipping) return sent;
+  bytesPlayed += sent;
+  progress.played(bytesPlayed);
+  STAT(if (sent) stats.firstAudio(millis());)
+
+  // remember where to resume: the last frame sent. it's only written to
+  // eeprom once things settle, or every state_max_wait_ms while playing.
+
+  if (sent) {
+    player.setOffset(stream.getFrame());
+  }
+  return sent;
+}
+
+// how much of the song has played, in percent. the multiply is split up so
+// that it can't overflow for large files.
+
+int Song::percentPlayed(){
+  uint32_t size = getAudioSize();
+
+  if (size == 0) return 0;
+  if (bytesPlayed >= size) return 100;
+  return (bytesPlayed / 256) * 100 / (size / 256 + 1);
+}
+
+// report the runtime statistics (see Stats.h). the underrun and uart counters
+// are always kept; the rest only with SONG_STATS defined.
+
+void Song::sendStats(){
+  handler->addKeyValuePair("command", "STATS", true);
+
+  // the sram the library's objects take, with the sizes in SongConfig.h: the
+  // sd library's (and its own 512 byte block buffer), the players', and the
+  // handler's. it's all sizeof()s, so this only changes with the players.
+
+  handler->addKeyValuePair("sramStatic", (long) (
+    sizeof(card) + sizeof(volume) + sizeof(sd_root) + cache_block_size +
+    sizeof(sd_dir) + sizeof(walker) + sizeof(library) + sizeof(block_cache) + sizeof(tasks) +
+    player_count * sizeof(Song) + sizeof(*handler) STAT(+ sizeof(stats))));
+
+  // which player this is, of how many. the underruns are this player's; the
+  // stats below count for all of them.
+
+  handler->addKeyValuePair("player", number);
+  handler->addKeyValuePair("players", player_count);
+  handler->addKeyValuePair("underruns", getUnderruns());
+  handler->addKeyValuePair("uartQueued", handler->getTxQueued());
+  handler->addKeyValuePair("uartSent", handler->getTxSent());
+  handler->addKeyValuePair("uartDropped", handler->getTxDropped());
+  handler->addKeyValuePair("eepromCommits", player.getCommits());
+
+  // per block of the block cache: lookups it answered, and microsd reads.
+
+  handler->beginArray("cacheHits");
+  for (unsigned char i = 0; i < cache_blocks; i++) {
+    handler->addKeyValuePair("", block_cache.getHits(i));
+  }
+  handler->end();
+  handler->beginArray("cacheMisses");
+  for (unsigned char i = 0; i < cache_blocks; i++) {
+    handler->addKeyValuePair("", block_cache.getMisses(i));
+  }
+  handler->end();
+  STAT(stats.report(handler);)
+  STAT(tasks.report(handler);)
+  handler->respond();
+}
+
+// answer a LIBRARY command, whose data is "offset:count": count songs of
+// the library, starting with song number offset. without a count, or with no
+// data at all, only the library's generation and size are sent, which is all
+// a client needs to decide whether the copy it kept is still good.
+
+void Song::sendLibrary(char* data){
+  unsigned int offset = 0, count = 0;
+
+  while (*data >= '0' && *data <= '9') {
+    offset = offset * 10 + (*data++ - '0');
+  }
+  if (*data++ == ':') {
+    while (*data >= '0' && *data <= '9') {
+      count = count * 10 + (*data++ - '0');
+    }
+  }
+  sendLibrary(offset, count);
+}
+
+// the reply starts with a LIBRARY message that says which songs follow; each
+// of them then comes as an ENTRY message of its own (see sendLibraryEntry()).
+// every message carries the generation, so a client can tell if the library
+// changed halfway through. a new request replaces a page still being sent.
+
+void Song::sendLibrary(unsigned int offset, unsigned int count){
+  if (offset > num_songs) offset = num_songs;
+  if (count > num_songs - offset) count = num_songs - offset;
+
+  handler->addKeyValuePair("command", "LIBRARY", true);
+  handler->addKeyValuePair("generation", library.getGeneration());
+  handler->addKeyValuePair("songs", num_songs);
+  handler->addKeyValuePair("folders", num_folders);
+  handler->addKeyValuePair("offset", offset);
+  handler->addKeyValuePair("count", count);
+  handler->respond();
+
+  library_next = offset;
+  library_left = count;
+}
+
+// an ENTRY message with empty tags and the longest numbers, with the end of
+// command character: 137 bytes, 138 where a long is 32 bits and the duration
+// may come out negative.
+
+#define entry_overhead    138
+
+#if library_entry_room < entry_overhead
+#error "library_entry_room must be at least 138, an ENTRY message without tags"
+#endif
+
+// cut a song's title, artist and album short, the longest (once escaped, see
+// JsonWriter) first, until together they take up at most room bytes of a
+// message.
+
+static void clip_tags(char* s[3], unsigned int room){
+  unsigned int len[3];
+  unsigned char end[3];
+  unsigned int total = 0;
+
+  for (unsigned char i = 0; i < 3; i++) {
+    len[i] = 0;
+    for (end[i] = 0; s[i][end[i]]; end[i]++) {
+      len[i] += JsonWriter::charLength(s[i][end[i]]);
+    }
+    total += len[i];
+  }
+
+  while (total > room) {
+    unsigned char k = 0;
+    for (unsigned char i = 1; i < 3; i++) {
+      if (len[i] > len[k]) k = i;
+    }
+    unsigned char w = JsonWriter::charLength(s[k][--end[k]]);
+    s[k][end[k]] = '\0';
+    len[k] -= w;
+    total -= w;
+  }
+}
+
+// a song's index record, or without an index, as much of one as opening the
+// song and scanning its tag gives (see open_song()). that's slow, but only a
+// card without an index needs it.
+
+bool Song::read_entry(unsigned int song, index_entry *entry){
+  CachedFile file;
+  Id3Tag song_tag;
+
+  if (library.read(song, entry)) {
+    return true;
+  }
+  if (!open_song(song, &file, &song_tag)) {
+    return false;
+  }
+  file.close();
+  memset(entry, 0, sizeof(*entry));
+  LibraryIndex::setTag(entry, &song_tag);
+  entry->folder = opened_folder;
+  return true;
+}
+
+// send the next song of the page, straight from its index record, if there's
+// room for it in the uart's ring. the library task sends the page this way, a
+// song at a time, whenever the ring has library_entry_room (see SongConfig.h)
+// free, so a page of any size never holds up the decoder. a new library is
+// announced first, which drops what's left of a page of the old one. returns
+// true if something was sent.
+
+bool Song::sendLibraryEntry(){
+  index_entry entry;
+
+  if ((library_left == 0 && !library_announce) ||
+      tx_depth - handler->getTxLevel() < library_entry_room) {
+    return false;
+  }
+  if (library_announce) {
+    library_announce = false;
+    sendLibrary(0, 0);
+    return true;
+  }
+  if (!read_entry(library_next, &entry)) {
+    library_left = 0;
+    return false;
+  }
+
+  // the message has to fit in the room waited for, or queuing it would wait
+  // on the uart. tags that are too long for that (or that are full of
+  // characters that have to be escaped) are cut short.
+
+  char* tags[] = { entry.title, entry.artist, entry.album };
+  clip_tags(tags, library_entry_room - entry_overhead);
+
+  handler->addKeyValuePair("command", "ENTRY", true);
+  handler->addKeyValuePair("generation", library.getGeneration());
+  handler->addKeyValuePair("songNumber", library_next);
+  handler->addKeyValuePair("folder", entry.folder);
+  handler->addKeyValuePair("title", entry.title);
+  handler->addKeyValuePair("artist", entry.artist);
+  handler->addKeyValuePair("album", entry.album);
+  handler->addKeyValuePair("duration", entry.duration);
+  handler->respond();
+
+  library_next++;
+  library_left--;
+  return true;
+}
+
+// send whatever changed since the last progress event, if it's time to. an
+// event that only moves the position may be dropped if the uart falls behind;
+// one that carries a state or volume change may not.
+
+void Song::sendProgress(){
+  unsigned char what = progress.take(millis());
+  if (!what) return;
+
+  currPosition = percentPlayed();
+
+  if (what == PROGRESS_POSITION) {
+    handler->beginProgress();
+  }
+  handler->addKeyValuePair("command", "SEEK", true);
+  handler->addKeyValuePair("position", currPosition);
+  if (what & PROGRESS_STATE) {
+    handler->addKeyValuePair("state", isPlaying() ? "PLAYING" : "PAUSED" );
+  }
+  if (what & PROGRESS_VOLUME) {
+    handler->addKeyValuePair("volume", getVolume());
+  }
+  handler->respond();
+}
+
+// how often progress events are sent: every permille thousandths of a song,
+// or every ms milliseconds of it, but no more often than every interval ms.
+
+void Song::setProgressGranularity(unsigned int permille){
+  progress.setGranularity(permille);
+  progress.startTrack(getAudioSize(), getDuration(), bytesPlayed);
+}
+
+void Song::setProgressGranularityMs(unsigned int ms){
+  progress.setGranularityMs(ms);
+  progress.startTrack(getAudioSize(), getDuration(), bytesPlayed);
+}
+
+void Song::setProgressInterval(unsigned int ms){
+  progress.setInterval(ms);
+}
+
 uint32_t Song::getFileSize(){
-	return sd_file.fileSize();
+	return sd_file->fileSize();
+}
+
+// the number of bytes of audio in the song, leaving out its tags.
+
+uint32_t Song::getAudioSize(){
+	return tag->getAudioEnd() - tag->getAudioStart();
+}
+
+unsigned long Song::getUnderruns(){
+	return stream.getUnderruns();
+}
+
+// read the current song's frame headers, if we haven't tried already. the
+// file is left where it was, as the song may be streaming from it.
+
+bool Song::analyze(){
+  if (!info_tried) {
+    uint32_t pos = sd_file->curPosition();
+
+    info_tried = true;
+    info_ready = info.analyze(sd_file, tag->getAudioStart(), tag->getAudioEnd());
+    sd_file->seekSet(pos);
+  }
+  return info_ready;
+}
+
+// how long the current song plays, in milliseconds (0 if it isn't an mp3).
+
+uint32_t Song::getDuration(){
+  if (tag->getDuration() == 0 && analyze()) {
+    tag->setDuration(info.getDuration());
+  }
+  return tag->getDuration();
+}
+
+// continue playing from offset in the current song's file.
+
+void Song::seek_to(uint32_t offset) {
+  if (dipping) {
+    start_picked();
+  }
+  sd_file->seekSet(offset);
+  stream.reset(sd_file, offset, tag->getAudioEnd());
+  player.setOffset(offset);
+  bytesPlayed = offset - tag->getAudioStart();
+  progress.startTrack(getAudioSize(), getDuration(), bytesPlayed);
 }
 
+// seek to a percentage of the song's time. for an mp3, that's looked up from
+// its frame headers and lands on a frame. anything else (i.e. a wav file) is
+// assumed to have a constant bitrate.
+
 int Song::seek(int percent) {
   if (percent < 0 || percent > 100) return 0;
-  uint32_t size = sd_file.fileSize();
-  uint32_t seekPos = percent * (getFileSize() / 100);
-  seeked = sd_file.seekSet(seekPos);
+
+  // what's buffered won't be played any more. letting go of it leaves room
+  // in the block cache for the frame search, and the stream starts from there.
+
+  stream.stop();
+
+  uint32_t duration = getDuration();
+  if (duration && analyze()) {
+    seek_to(info.offsetAt(sd_file, duration / 100 * percent + duration % 100 * percent / 100));
+  }
+  else {
+    seek_to(tag->getAudioStart() + percent * (getAudioSize() / 100));
+  }
+
   currPosition = percent;
-  bytesPlayed = seekPos;
-  EEPROM.write(EEPROM_POSITION, currPosition);
   return percent;
 }
 
+// seek to ms milliseconds into the current song, landing on a frame. returns
+// false if the song isn't an mp3, and so can't be seeked by time.
+
+bool Song::seekTime(uint32_t ms) {
+  if (!getDuration() || !analyze()) return false;
+
+  stream.stop();
+  seek_to(info.offsetAt(sd_file, ms));
+  currPosition = percentPlayed();
+  return true;
+}
+
 // continue to play the current (playing) song, until there are no more songs
-// in the directory to play. 
+// in the directory to play. while the index is being brought up to date,
+// nothing plays until a song has been resumed (or picked), so that the songs
+// after it aren't opened from an index that's out of date.
 
 void Song::dir_play() {
-  if (current_song < num_songs) {
+  if ((resumed || indexing == INDEX_DONE) && current_song < num_songs) {
+    uint32_t pos = stream.position();
+    uint32_t end = tag->getAudioEnd();
+
+    if (!next_ready && !dipping && nextFileExists() &&
+        (pos >= end || end - pos <= prefetch_window)) {
+      prefetch_next();
+    }
+
     mp3_play();
 
-    // if current_state is IDLE, then the currently playing song just ended.
+    // if the next song was prefetched, mp3_play() has already moved on to it.
+    // otherwise, if current_state is IDLE, the currently playing song just ended.
     // in that case, increment to get the next song to play, open that file,
     // and return to the DIR_PLAY state (which will then play that song).
     // if we played the last part of the last song, we don't do anything,
@@ -252,19 +969,67 @@ bool Song::isPlaying(){
 	return current_state == MP3_PLAY || current_state == DIR_PLAY;
 }
 
-double Song::setVolume(int volume_percentage){
-	double vol = volume_percentage /100.0;
-	double vol2 = pow(2.7182818, vol) * 93.8;
-	mp3Volume = vol2;
-	Mp3.volume(mp3Volume);
-	EEPROM.write(EEPROM_VOLUME, volume_percentage);
-	return mp3Volume;
+// true while the library index is still being brought up to date (after a
+// fast boot). until then, the songs are looked up in the index as it was.
+
+bool Song::isIndexing(){
+	return indexing != INDEX_DONE;
+}
+
+// set the volume, in percent. it's faded to over volume_ramp_ms, so it
+// doesn't click. returns the decoder's level for it.
+
+int Song::setVolume(int volume_percentage){
+	fadeTo(volume_percentage, volume_ramp_ms);
+	return Fader::toLevel(volume_percent);
 }
 
 int Song::getVolume(){
-	double toReturn = mp3Volume/ 93.8;
-	toReturn = log(toReturn) * 100;
-	return toReturn;
+	return volume_percent;
+}
+
+// fade to a volume, in percent, over ms milliseconds. while the player is
+// pausing, or dipping for a new song, the volume is only set; it's faded to
+// once the player plays again.
+
+void Song::fadeTo(int percent, unsigned int ms){
+	if (percent < 0) percent = 0;
+	if (percent > max_volume) percent = max_volume;
+
+	volume_percent = percent;
+	player.setVolume(volume_percent);
+	progress.mark(PROGRESS_VOLUME);
+
+	if (!pausing && !dipping) {
+		fade.begin(volume_level, Fader::toLevel(volume_percent), ms, millis());
+	}
+}
+
+void Song::set_level(uint8_t level){
+	volume_level = level;
+	set_volume(context, level);
+}
+
+// take the fade a step further, if one is under way. when a fade out for a
+// pause is done, the player pauses; when one for a new song is, it fades back
+// in.
+
+void Song::fade_step(unsigned long now){
+	uint8_t level;
+
+	if (fade.step(now, &level)) {
+		set_level(level);
+	}
+	if (fade.isActive()) {
+		return;
+	}
+	if (pausing) {
+		pausing = false;
+		pause_now();
+	}
+	else if (dipping) {
+		start_picked();
+	}
 }
 
 // setup is pretty straightforward. initialize serial communication (used for
@@ -272,93 +1037,251 @@ int Song::getVolume(){
 // the first song in the root library to play.
 
 Song::Song() {
-	tag = Id3Tag();
+  init(dreq, mp3_data, mp3_volume, NULL);
+  uses_mp3 = true;
+}
+
+Song::Song(unsigned char dreq_pin, decoder_data data, decoder_volume volume, void* context) {
+  init(dreq_pin, data, volume, context);
 }
 
+void Song::init(unsigned char dreq_pin, decoder_data data, decoder_volume volume, void* context) {
+  handler = NULL;
+  number = 0;
+  this->dreq_pin = dreq_pin;
+  set_volume = volume;
+  this->context = context;
+  uses_mp3 = false;
+  stream.setDecoder(data, context);
+
+  sd_file = &sd_files[0];
+  next_file = &sd_files[1];
+  tag = &tags[0];
+  next_tag = &tags[1];
+  current_song = 0;
+  info_ready = false;
+  info_tried = false;
+  next_song = 0;
+  next_ready = false;
+
+  // the program is setup to enter DIR_PLAY mode immediately.
+
+  current_state = DIR_PLAY;
+  last_state = DIR_PLAY;
+  repeat = true;
+  library_next = 0;
+  library_left = 0;
+  library_announce = false;
+  fast_boot = true;
+  resumed = false;
+  index_current = 0;
+  index_cluster = 0;
+  folder_play = false;
+  current_folder = 0;
+  next_folder = 0;
+  opened_folder = 0;
+  folder_first = 0;
+  folder_count = 0;
+  volume_percent = Fader::toPercent(mp3_vol);
+  volume_level = 0;
+  pausing = false;
+  dipping = false;
+  currPosition = -1;
+  bytesPlayed = 0;
+}
+
+// the state read back is always one of ours: IDLE is the last of them. the
+// volume is always a percent, see PlayerState::begin().
+
 void Song::initPlayerStateFromEEPROM(){
-  if (EEPROM.read(EEPROM_FIRSTRUN) == EEPROM_INIT_ID){
+  if (player.begin(number, Fader::toPercent(mp3_vol), 0, DIR_PLAY, IDLE + 1)){
 	//read persisted states from EEPROM
-	mp3Volume = EEPROM.read(EEPROM_VOLUME);
-	current_song = EEPROM.read(EEPROM_TRACK);
-	current_state = (state)EEPROM.read(EEPROM_STATE);
+	volume_percent = player.getVolume();
+	current_song = player.getTrack();
+	current_state = (state)player.getState();
 	Serial.println("Reading player state from EEPROM");
 	Serial.print("Volume: ");
-	Serial.println(mp3Volume);
+	Serial.println(volume_percent);
 	Serial.print("Song: ");
 	Serial.println(current_song);
 	Serial.print("State: ");
 	Serial.println(current_state);
   }
   else{
-	  mp3Volume = mp3_vol;
+	  volume_percent = Fader::toPercent(mp3_vol);
 	  current_song = 0;
 	  current_state = DIR_PLAY;
 	  currPosition = 0;
-	  EEPROM.write(EEPROM_FIRSTRUN, EEPROM_INIT_ID);
-	  EEPROM.write(EEPROM_VOLUME, mp3Volume);
-	  EEPROM.write(EEPROM_TRACK, current_song);
-	  EEPROM.write(EEPROM_STATE, current_state);
-	  EEPROM.write(EEPROM_POSITION, currPosition);
 	  Serial.println("First run: Initializing EEPROM state");
   }
 }
 
 void Song::setup(JsonHandler *_handler){
+  setup(_handler, true);
+}
+
+// with fast_boot, the song we left off with starts playing before the library
+// index is brought up to date: loop() does that, a slice at a time. the first
+// player set up brings up the microsd card and the index, for all of them.
+
+void Song::setup(JsonHandler *_handler, bool fast){
   Serial.begin(9600);
 
+  if (player_count == max_players) {
+    Serial.println("Too many players, see max_players.");
+    return;
+  }
+  number = player_count;
+  players[player_count++] = this;
+
   handler = _handler;
+  fast_boot = fast;
 
   initPlayerStateFromEEPROM();
 
   pinMode(SS_PIN, OUTPUT);  //SS_PIN must be output to use SPI
 
   // the default state of the mp3 decoder chip keeps the SPI bus from 
-  // working with other SPI devices, so we have to initialize it first.
-  Mp3.begin(mp3_cs, dcs, rst, dreq);
+  // working with other SPI devices, so we have to deselect it first. it's
+  // only initialized once the microsd card is up.
+  if (uses_mp3) {
+    pinMode(mp3_cs, OUTPUT);
+    digitalWrite(mp3_cs, HIGH);
+    pinMode(dcs, OUTPUT);
+    digitalWrite(dcs, HIGH);
+  }
 
   // initialize the microsd (which checks the card, volume and root objects).
-  sd_card_setup();
+  if (number == 0) {
+    sd_card_setup();
+  }
 
   // initialize the mp3 library, and set default volume. 'mp3_cs' is the chip
   // select, 'dcs' is data chip select, 'rst' is reset and 'dreq' is the data
   // request. the decoder raises the dreq line (automatically) to signal that
   // it's input buffer can accommodate 32 more bytes of incoming song data.
   // we need to set the SPI speed with the mp3 initialize function since
-  // it is the limiting factor, so we call its init function again.
-
-  Mp3.begin(mp3_cs, dcs, rst, dreq);
-  setVolume(mp3Volume);
+  // it is the limiting factor. any other decoder is up to the sketch.
 
-  // putting all of the root directory's songs into eeprom saves flash space.
-
-  sd_dir_setup();
-//  sd_file_open();
+  if (uses_mp3) {
+    Mp3.begin(mp3_cs, dcs, rst, dreq);
+  }
 
-  //can't be read with other EEPROM settings b/c sd_file_open resets currPosition
-  //no need to worry about reading un-inited value b/c the initEEPROM case sets currPos
-  currPosition = EEPROM.read(EEPROM_POSITION);
-  seek(currPosition);
+  // the decoder starts out silent; the song we left off with fades in.
+
+  set_level(0);
+
+  // bring the library index up to date with the card's songs, then open the
+  // song we left off with. with fast boot, it's opened from the index as it
+  // was, if it's still there. if not, index_done() opens it later. a player
+  // set up after the first just opens its song from the index as it is.
+
+  if (number == 0) {
+    tasks.add("index", index_task, NULL, index_task_us);
+    tasks.add("library", library_task, NULL, library_task_us);
+    tasks.add("state", state_task, NULL, state_task_us);
+    tasks.add("commands", command_task, NULL, command_task_us);
+    tasks.add("fade", fade_task, NULL, fade_task_us);
+    start_index();
+    if (fast_boot) {
+      num_songs = library.getCount();
+      num_folders = library.getFolderCount();
+    }
+    else {
+      while (index_step());
+    }
+  }
+  else {
+    index_entry entry;
 
-  // the program is setup to enter DIR_PLAY mode immediately, so this call to
-  // open the root directory before reaching the state machine is needed.
+    index_current = current_song;
+    index_cluster = library.read(current_song, &entry) ? entry.cluster : 0;
+  }
+  if (!resumed) {
+    resumed = resume();
+  }
+  if (isPlaying()) {
+    fade.begin(0, Fader::toLevel(volume_percent), fade_in_ms, millis());
+  }
 
   Serial.println("Song setup");
 }
 
+// pausing fades the song out over fade_out_ms first; fade_step() pauses the
+// player once it's silent. playing again fades it back in over fade_in_ms,
+// from wherever the fade out got to.
+
 void Song::pause(){
+	if (current_state != IDLE && !pausing){
+		if (dipping) {
+			start_picked();
+		}
+		pausing = true;
+		fade.begin(volume_level, 0, fade_out_ms, millis());
+	}
+}
+
+void Song::pause_now(){
 	if (current_state != IDLE){
 		last_state = current_state;
 		current_state = IDLE;
-		EEPROM.write(EEPROM_STATE, current_state);
+		player.setState(current_state);
+		progress.mark(PROGRESS_STATE);
 	}
 }
 
 void Song::play(){
-	if (current_state == IDLE){
+	if (pausing){
+		pausing = false;
+	}
+	else if (current_state == IDLE){
 		//set current_state to last_state unless last_state was also IDLE, then set to DIR_PLAY
 		current_state = last_state != IDLE ? last_state : DIR_PLAY;
-		EEPROM.write(EEPROM_STATE, current_state);
+		stream.resume();
+		player.setState(current_state);
+		progress.mark(PROGRESS_STATE);
+		set_level(0);
+	}
+	else {
+		return;
 	}
+	fade.begin(volume_level, Fader::toLevel(volume_percent), fade_in_ms, millis());
+}
+
+// one pass of every player's state machine (see run()), and of the work they
+// share. whichever player it's called on, it runs them all.
+
+void Song::loop() {
+  STAT(unsigned long started = micros();)
+
+  // a response may only wait for the uart while there's no decoder to feed.
+
+  bool idle = true;
+  for (unsigned char i = 0; i < player_count; i++) {
+    idle = idle && players[i]->current_state == IDLE;
+  }
+  for (unsigned char i = 0; i < player_count; i++) {
+    players[i]->handler->setWait(idle);
+  }
+
+  reader = neediest();
+  for (unsigned char i = 0; i < player_count; i++) {
+    players[i]->run();
+  }
+
+  // then the background work: indexing the library, sending library pages
+  // and so on, for as long as every decoder has plenty to play.
+
+  tasks.run(gate);
+
+  // send what the uart has had time for since the last loop. this never
+  // waits on the uart, so it doesn't matter how hungry the decoders are.
+
+  for (unsigned char i = 0; i < player_count; i++) {
+    players[i]->handler->drain();
+  }
+
+  STAT(stats.loopTime(micros() - started);)
 }
 
 // the state machine is setup (at least, at first) to open the microsd card's
@@ -370,7 +1293,7 @@ void Song::play(){
 // switches into IDLE. this example program doesn't enter the MP3_PLAY state,
 // as its goal (for now) is just to play all the songs. you can change that.
 
-void Song::loop() {
+void Song::run() {
   switch(current_state) {
 
   case DIR_PLAY:
@@ -387,11 +1310,146 @@ void Song::loop() {
 	  //Serial.println("IDLE");
     break;
   }
+
+  sendProgress();
+}
+
+// how long the decoder can play before it gets down to feed_watermark bytes,
+// counting its own fifo (full, when dreq is low) and what's buffered for it,
+// in us. background work may take that long. a decoder that isn't playing
+// doesn't limit it at all.
+
+unsigned long Song::runway() {
+  if (current_state == IDLE || !sd_file->isOpen()) {
+    return task_budget_us;
+  }
+  if (digitalRead(dreq_pin)) {
+    return 0;
+  }
+
+  uint32_t bytes = decoder_fifo - dreq_chunk + stream.buffered();
+  if (bytes <= feed_watermark) {
+    return 0;
+  }
+
+  // bytes per ms, rounded up to err on the short side.
+
+  uint32_t duration = tag->getDuration();
+  uint32_t rate = duration ? getAudioSize() / duration + 1 : max_bytes_per_ms;
+
+  return (bytes - feed_watermark) * 1000 / rate;
+}
+
+// the scheduler's gate: feed every playing decoder what's buffered for it,
+// then see how long the one with the least to play can go on without us. a
+// stream that's waiting for the card is left to the next loop(), so this
+// doesn't count as an underrun.
+
+unsigned long Song::gate() {
+  unsigned long room = task_budget_us;
+
+  for (unsigned char i = 0; i < player_count; i++) {
+    Song* p = players[i];
+
+    if (p->isPlaying() && p->stream.buffered()) {
+      p->feed();
+    }
+    unsigned long r = p->runway();
+    if (r < room) {
+      room = r;
+    }
+  }
+  return room;
+}
+
+// the library's background tasks. each takes a step for every player, and
+// says if it has more to do right away.
+
+bool Song::index_task(void* context) {
+  return indexing != INDEX_DONE && players[0]->index_step();
+}
+
+bool Song::library_task(void* context) {
+  bool more = false;
+
+  for (unsigned char i = 0; i < player_count; i++) {
+    if (players[i]->sendLibraryEntry()) {
+      more = true;
+    }
+  }
+  return more;
+}
+
+bool Song::state_task(void* context) {
+  for (unsigned char i = 0; i < player_count; i++) {
+    Song* p = players[i];
+    p->player.loop(millis(), p->current_state == IDLE);
+  }
+  return false;
+}
+
+bool Song::fade_task(void* context) {
+  unsigned long now = millis();
+
+  for (unsigned char i = 0; i < player_count; i++) {
+    players[i]->fade_step(now);
+  }
+  return false;
+}
+
+// commands are only read here for a sketch that takes them with a callback
+// (see JsonHandler::onCommand()). otherwise the sketch reads them itself.
+
+bool Song::command_task(void* context) {
+  bool more = false;
+
+  for (unsigned char i = 0; i < player_count; i++) {
+    JsonHandler* h = players[i]->handler;
+    if (h->hasCallback() && h->readCommand()) {
+      more = true;
+    }
+  }
+  return more;
 }
 
+// add a background task of the sketch's own, e.g. updating a display. see
+// Scheduler.h for what step should do. false if there's no room for it.
+
+bool Song::addTask(const char* name, task_step step, void* context, unsigned int slice_us) {
+  return tasks.add(name, step, context, slice_us);
+}
 
+// the player whose stream reads from the card this pass, if any needs to. only
+// one does, so a read for one decoder holds up the others' feeds by a single
+// fill at most. a decoder that's asking for data (dreq high) goes before one
+// that isn't, then the one with the least left to send. ties go round robin,
+// starting after the player served last, so every player gets its turn.
 
+Song* Song::neediest() {
+  Song* best = NULL;
+  bool best_asks = false;
+  uint32_t best_left = 0;
 
+  for (unsigned char i = 1; i <= player_count; i++) {
+    Song* p = players[(served + i) % player_count];
+
+    if (!p->isPlaying() || !p->stream.needsFill()) {
+      continue;
+    }
+    bool asks = digitalRead(p->dreq_pin);
+    uint32_t left = p->stream.buffered();
+
+    if (best == NULL || (asks && !best_asks) || (asks == best_asks && left < best_left)) {
+      best = p;
+      best_asks = asks;
+      best_left = left;
+    }
+  }
+  if (best) {
+    served = best->number;
+  }
+  return best;
+}
 
 // check that the microsd card is present, can be initialized and has a valid
 // root volume. a pointer to the card's root object is returned as sd_root.
@@ -409,127 +1467,338 @@ void Song::sd_card_setup() {
     Serial.println("Partition found, but couldn't open root");
     return;
   }
+  block_cache.begin(&card);
+}
+
+// is this directory entry a song? only mp3 and wav files are songs (for now).
+// if you add other file types, you should add their extension here.
+
+// it's okay to hard-code the 8, 9 and 10 as indices here, since SdFatLib
+// pads shorter file names with a ' ' to fill 8 characters. the result is
+// that file extensions are always stored in the last 3 positions.
+
+bool Song::is_song(dir_t *p) {
+  // only count current (not deleted) file entries, and ignore the . and ..
+  // sub-directory entries. sub-directories are walked as folders instead.
+
+  if (p->name[0] == DIR_NAME_DELETED || p->name[0] == '.' || !DIR_IS_FILE(p)) {
+    return false;
+  }
+
+  return (p->name[8] == 'M' && p->name[9] == 'P' && p->name[10] == '3') ||
+         (p->name[8] == 'W' && p->name[9] == 'A' && p->name[10] == 'V');
+}
+
+// every song file on the card, in the root directory or in a folder, has a
+// record in the library index on the microsd card, holding its file name,
+// tags and where its audio starts. that saves opening and scanning every
+// song at every boot, and it also allows users to change the songs on the
+// SD card, and not have to change the code to play new songs.
+
+// a first pass walks the folders (see FolderWalk.h), counting the songs in
+// each and checksumming their entries, and the folders'. if the index was
+// built from the same entries, it's used as is. otherwise a second pass
+// scans the songs whose records don't match, and rewrites just those. the
+// library itself isn't sent here: clients ask for it a page at a time.
+//
+// both passes are done a slice at a time, by index_step(): a block's worth of
+// directory entries, or one song's tag. setup() either runs them to the end
+// before anything plays, or (with fast boot) resumes the last song first, and
+// leaves loop() to run a slice whenever the decoder has plenty to play.
+
+void Song::start_index() {
+  index_entry entry;
+
+  // without an index (say the card is write protected), songs are found by
+  // walking the folders, and their tags are scanned as they're opened.
+
+  index_open = library.begin(&sd_root);
+  if (!index_open) {
+    Serial.println("Couldn't open the library index.");
+  }
+
+  walker.begin();
+  indexing = INDEX_WALK;
+  index_pos = 0;
+  index_folders = 0;
+  index_songs = 0;
+  index_checksum = 0;
+  for (unsigned char i = 0; i < player_count; i++) {
+    Song *p = players[i];
+    p->index_current = p->current_song;
+    p->index_cluster = library.read(p->current_song, &entry) ? entry.cluster : 0;
+  }
+}
+
+// run one slice of the indexing. returns false once the index is up to date.
+
+bool Song::index_step() {
+  STAT(unsigned long started = micros();)
+
+  switch (indexing) {
+  case INDEX_WALK:
+    index_walk();
+    break;
+
+  case INDEX_UPDATE:
+    index_update();
+    break;
+
+  case INDEX_DONE:
+    return false;
+  }
+
+  STAT(stats.indexSlice(micros() - started);)
+  return indexing != INDEX_DONE;
 }
 
-// for each song file in the current directory, store its file name in eeprom
-// for later retrieval. this saves on using program memory for the same task,
-// which is helpful as you add more functionality to the program. it also allows
-// users to change the songs on the SD card, and not have to change the code to
-// play new songs. if you would like to store subdirectories, talk to an 
-// instructor.
+// the first pass: a slice of one folder's entries. its songs are counted and
+// checksummed, and so are its sub-folders, which the walk goes into next.
 
-void Song::sd_dir_setup() {
-	int oldCurrentSong = current_song;
-  handler->respondString("{\"command\": \"LIBRARY\",\"songs\":[");
+void Song::index_walk() {
   dir_t p;
-  num_songs = 0;
-  
-  sd_root.rewind();
-  
-  while (sd_root.readDir(&p) > 0 && num_songs < max_num_songs) {
-    // break out of while loop when we wrote all files (past the last entry).
+  SdFile *dir = walker.getDir();
+
+  if (index_pos == 0) {
+    index_first = index_songs;
+  }
+  dir->seekSet((uint32_t) index_pos * sizeof(dir_t));
+
+  for (unsigned char n = 0; n < index_slice_entries; n++) {
+    // the folder is done when we read all files (past the last entry).
+
+    if (dir->readDir(&p) <= 0 || p.name[0] == DIR_NAME_FREE) {
+      folder_entry folder = *walker.getEntry();
+      folder.first_song = index_first;
+      folder.song_count = index_songs - index_first;
+      if (index_open) {
+        library.writeFolder(index_folders, &folder);
+      }
+      index_folders++;
+      index_pos = 0;
+
+      if (index_folders < max_folders && walker.next()) {
+        return;
+      }
+
+      // the whole card has been walked.
+
+      if (!index_open || library.matches(index_songs, index_checksum)) {
+        index_finish(false);
+      }
+      else {
+        Serial.println("Updating the library index");
+        walker.begin();
+        indexing = INDEX_UPDATE;
+        index_song = 0;
+      }
+      return;
+    }
+    index_pos = dir->curPosition() / sizeof(dir_t);
+
+    if (is_song(&p) && index_songs < max_index_songs) {
+      index_checksum = LibraryIndex::dir_checksum(index_checksum, &p);
+      index_songs++;
+    }
+    else if (FolderWalk::isFolder(&p)) {
+      index_checksum = LibraryIndex::dir_checksum(index_checksum, &p);
+    }
+  }
+}
+
+// the second pass: bring a slice of one folder's song records up to date,
+// scanning at most one song. the scan borrows the first player's next_file
+// and next_tag, so it waits while a song is prefetched into them, or plays
+// out from them (see sd_file_open()).
+
+void Song::index_update() {
+  dir_t p;
+  index_entry entry;
+  SdFile *dir = walker.getDir();
+  char name[max_name_len];
+
+  if (index_song == index_songs) {
+    if (!library.finish(index_songs, index_folders, index_checksum)) {
+      Serial.println("Couldn't write the library index.");
+    }
+    index_finish(true);
+    return;
+  }
+  if (next_ready || dipping) {
+    return;
+  }
+  dir->seekSet((uint32_t) index_pos * sizeof(dir_t));
 
-    if (p.name[0] == DIR_NAME_FREE) {
-      break;
+  for (unsigned char n = 0; n < index_slice_entries; n++) {
+    if (dir->readDir(&p) <= 0 || p.name[0] == DIR_NAME_FREE) {
+      // on to the next folder. if there are none left, the songs counted in
+      // the first pass have gone missing since; the index is finished all
+      // the same, and they're found again at the next boot.
+
+      index_pos = 0;
+      if (!walker.next()) {
+        index_song = index_songs;
+      }
+      return;
     }
-    
-    // only store current (not deleted) file entries, and ignore the . and ..
-    // sub-directory entries. also ignore any sub-directories.
-    
-    if (p.name[0] == DIR_NAME_DELETED || p.name[0] == '.' || !DIR_IS_FILE(&p)) {
+    index_pos = dir->curPosition() / sizeof(dir_t);
+
+    if (!is_song(&p)) {
       continue;
     }
+    uint16_t dir_index = index_pos - 1;
+    bool scanned = false;
+
+    if (!library.read(index_song, &entry) || !LibraryIndex::describes(&entry, &p) ||
+        entry.folder != walker.getFolder() || entry.dir_index != dir_index) {
+      // the song is new, has changed, or has moved since the index was
+      // written. a song without a title gets its file name. its own Mp3Info,
+      // since info describes the song that's playing.
+
+      Mp3Info song_info;
+
+      LibraryIndex::formatName((char*) p.name, name);
+      next_file->open(dir, dir_index, FILE_READ);
+      next_tag->scan(next_file, name);
+      if (song_info.analyze(next_file, next_tag->getAudioStart(), next_tag->getAudioEnd())) {
+        next_tag->setDuration(song_info.getDuration());
+      }
+      next_file->close();
+
+      LibraryIndex::setFile(&entry, &p);
+      LibraryIndex::setTag(&entry, next_tag);
+      entry.folder = walker.getFolder();
+      entry.dir_index = dir_index;
+      if (!library.write(index_song, &entry)) {
+        // finish() will fail too, and close the index.
+
+        index_song = index_songs;
+        return;
+      }
+      scanned = true;
+    }
+
+    // the playing song (or the one we left off with) may have a different
+    // number in the new index.
 
-    // only store mp3 or wav files in eeprom (for now). if you add other file
-    // types, you should add their extension here.
-
-    // it's okay to hard-code the 8, 9 and 10 as indices here, since SdFatLib
-    // pads shorter file names with a ' ' to fill 8 characters. the result is
-    // that file extensions are always stored in the last 3 positions.
-    
-    if ((p.name[8] == 'M' && p.name[9] == 'P' && p.name[10] == '3') ||
-        (p.name[8] == 'W' && p.name[9] == 'A' && p.name[10] == 'V')) {
-	  if(num_songs != 0){
-		handler->respondString(",");
-	  }
-      // store each character of the file name into an individual byte in the
-      // eeprom. sd_file->name doesn't return the '.' part of the name, so we
-      // add that back later when we read the file from eeprom.
-    
-      unsigned char pos = 0;
-
-      for (unsigned char i = 0; i < 11; i++) {
-        if (p.name[i] != ' ') {
-          EEPROM.write(FILE_NAMES_START + num_songs * max_name_len + pos, p.name[i]);
-          pos++;
-        }
+    // the playing songs (or the ones left off with) may have different
+    // numbers in the new index.
+
+    for (unsigned char i = 0; i < player_count; i++) {
+      Song *playing = players[i];
+      if (entry.cluster == (playing->sd_file->isOpen() ?
+          playing->sd_file->firstCluster() : playing->index_cluster)) {
+        playing->index_current = index_song;
       }
-    
-      // add an 'end of string' character to signal the end of the file name.
-    
-      EEPROM.write(FILE_NAMES_START + num_songs * max_name_len + pos, '\0');
-	  current_song = num_songs;
-	  map_current_song_to_fn();
-	  //Serial.println("-------------------------------");
-	  //Serial.println(fn);
-	  sd_file.close();
-	  sd_file.open(&sd_root, fn, FILE_READ);
-	  
-	  tag.scan(&sd_file);
-	  sendSongInfo(true);
-	  handler->respond(false);
-	  num_songs++;
-    }
-  }
-  //Serial.println("NM");
-  //Serial.println(num_songs);
-  handler->respondString("]}!");
-  current_song = oldCurrentSong;
+    }
+    index_song++;
+
+    if (scanned || index_song == index_songs) {
+      return;
+    }
+  }
+}
+
+// the index is up to date. every player is told, see index_done().
+
+void Song::index_finish(bool changed) {
+  indexing = INDEX_DONE;
+  num_songs = index_songs;
+  num_folders = index_folders;
+  STAT(stats.indexed(millis());)
+
+  // the folders may have been renumbered, so sd_dir may not hold the one it
+  // says it does.
+
+  if (changed) {
+    dir_folder = no_folder;
+  }
+  for (unsigned char i = 0; i < player_count; i++) {
+    players[i]->index_done(changed);
+  }
+}
+
+// the playing song (or the one we left off with) is given its number in the
+// new index. if no song could be opened before, from the index as it was,
+// the one we left off with is opened now.
+
+void Song::index_done(bool changed) {
+  index_entry entry;
+
+  if (changed && library.read(index_current, &entry) &&
+      entry.cluster == (resumed ? sd_file->firstCluster() : index_cluster)) {
+    current_song = index_current;
+  }
+
+  if (!resumed) {
+    if (current_song >= num_songs) {
+      current_song = 0;
+    }
+    resumed = resume();
+    player.setTrack(current_song);
+
+    if (resumed && fast_boot) {
+      handler->addKeyValuePair("message","Next Song", true);
+      sendSongInfo();
+      handler->respond();
+    }
+  }
+  else if (changed) {
+    if (current_song >= num_songs) {
+      current_song = 0;
+    }
+    cancel_prefetch();
+    if (library.read(current_song, &entry)) {
+      set_folder(entry.folder);
+    }
+    player.setTrack(current_song);
+  }
+
+  // tell the client which library this is. it asks for the songs it
+  // doesn't have yet with LIBRARY commands (see sendLibrary()).
+
+  library_announce = true;
+}
+
+// open the song we left off with, where we left off. false if it isn't in the
+// index (yet), or isn't where the index says it is.
+
+bool Song::resume() {
+  if (current_song >= num_songs || !open_song(current_song, sd_file, tag)) {
+    return false;
+  }
+  set_folder(opened_folder);
+
+  // the saved offset is a frame (see FrameTracker.h), so it's seeked to as
+  // is. one that isn't in the song's audio (e.g. the song was replaced)
+  // starts it over.
+
+  uint32_t offset = player.getOffset();
+  if (offset < tag->getAudioStart() || offset >= tag->getAudioEnd()) {
+    offset = tag->getAudioStart();
+  }
+  seek_to(offset);
+  currPosition = percentPlayed();
+
+  // nothing has changed yet as far as the client is concerned; it's sent the
+  // whole player state when it connects.
+
+  progress.clear();
+  return true;
 }
 
 char* Song::getTitle(){
-	return tag.getTitle();
+	return tag->getTitle();
 }
 
 char* Song::getArtist(){
-	return tag.getArtist();
+	return tag->getArtist();
 }
 
 char* Song::getAlbum(){
-	return tag.getAlbum();
+	return tag->getAlbum();
 }
 
 char* Song::getTime(){
-	return tag.getTime();
+	return tag->getTime();
 }
-
-// given the numerical index of a particular song to play, go to its location
-// in eeprom, retrieve its file name and set the global variable 'fn' to it.
-
-void Song::map_current_song_to_fn() {
-  int null_index = max_name_len - 1;
-  
-  // based on the current_song index, get song's name and null index position from eeprom.
-  
-  for (int i = 0; i < max_name_len; i++) {
-    fn[i] = EEPROM.read(FILE_NAMES_START + current_song * max_name_len + i);
-    
-    // break if we reach the end of the file name.
-    // keep track of the null index position, so we can put the '.' back.
-    
-    if (fn[i] == '\0') {
-      null_index = i;
-      break;
-    }
-  }
-  
-  // now restore the '.' that dir_t->name didn't store in its array for us.
-  
-  if (null_index > 3) {
-    fn[null_index + 1] = '\0';
-    fn[null_index]     = fn[null_index - 1];
-    fn[null_index - 1] = fn[null_index - 2];
-    fn[null_index - 2] = fn[null_index - 3];
-    fn[null_index - 3] = '.';
-  }
-}
\ No newline at end of file
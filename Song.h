@@ -6,25 +6,64 @@
 #ifndef SONG_H
 #define SONG_H
 
+#include <SongConfig.h>
 #include <Id3Tag.h>
 #include <JsonHandler.h>
+#include <LibraryIndex.h>
+#include <CachedFile.h>
+#include <StreamBuffer.h>
+#include <Mp3Info.h>
+#include <Progress.h>
+#include <PlayerState.h>
+#include <Scheduler.h>
+#include <Fader.h>
+
+// a Song is one player: a decoder, and the song it plays. up to max_players
+// (see SongConfig.h) of them can share the one microsd card, the library
+// index and the block cache. Song() plays through the mp3 library's decoder;
+// any others are driven through a pair of functions given to the constructor,
+// with context passed back to them. the decoders have to be deselected before
+// the first setup(), since that brings up the card on the same spi bus.
+//
+// loop() runs every player that's been set up, so calling it on any one of
+// them will do. the players take turns at the card, see neediest(), and the
+// background work is left to the scheduler (see Scheduler.h). a sketch can
+// give it tasks of its own with addTask().
+
+typedef void (*decoder_volume)(void* context, unsigned char volume);
 
 class Song
 {
   public:
 	Song();
+	Song(unsigned char dreq_pin, decoder_data data, decoder_volume volume, void* context);
 	void setup(JsonHandler *handler);
+	void setup(JsonHandler *handler, bool fast_boot);
 	void loop();
 	void pause();
 	void play();
 	int seek(int percent);
-	double setVolume(int volume_percentage);
+	bool seekTime(uint32_t ms);
+	uint32_t getDuration();
+	int setVolume(int volume_percentage);
 	int getVolume();
+	void fadeTo(int percent, unsigned int ms);
 	bool nextFile();
 	bool prevFile();
+	bool nextFolder();
+	bool prevFolder();
+	void setFolderPlay(bool on);
+	unsigned int getFolder();
 	void setSong(int songNumber);
 	uint32_t getFileSize();
+	uint32_t getAudioSize();
+	unsigned long getUnderruns();
+	int percentPlayed();
+	void setProgressGranularity(unsigned int permille);
+	void setProgressGranularityMs(unsigned int ms);
+	void setProgressInterval(unsigned int ms);
 	bool isPlaying();
+	bool isIndexing();
 
 	char* getTitle();
 	char* getArtist();
@@ -33,22 +72,158 @@ class Song
 
 	void sendPlayerState();
 	void sendSongInfo();
+	void sendStats();
+	void sendLibrary(char* data);
+	void sendLibrary(unsigned int offset, unsigned int count);
+	static bool addTask(const char* name, task_step step, void* context, unsigned int slice_us);
   private:
-	JsonHandler *handler;
+	enum state {
+	  DIR_PLAY, MP3_PLAY, IDLE };
+
+	void init(unsigned char dreq_pin, decoder_data data, decoder_volume volume, void* context);
+	void run();
+	unsigned int feed();
+	unsigned long runway();
+	static Song* neediest();
+	static unsigned long gate();
+
+	static bool index_task(void* context);
+	static bool library_task(void* context);
+	static bool state_task(void* context);
+	static bool command_task(void* context);
+	static bool fade_task(void* context);
 
 	void sd_file_open();
+	bool open_song(unsigned int song, CachedFile *file, Id3Tag *song_tag);
+	SdFile* open_folder(unsigned int folder, folder_entry *entry);
+	bool read_folder(unsigned int folder, folder_entry *entry);
+	bool walk_to(unsigned int folder, unsigned int song, folder_entry *entry, unsigned int *number);
+	void set_folder(unsigned int folder);
+	bool following(unsigned int song, unsigned int *next);
+	void prefetch_next();
+	void cancel_prefetch();
+	void start_next();
 	bool nextFileExists();
 	bool prevFileExists();
 
 	void dir_play();
 	void mp3_play();
+	bool analyze();
+	void seek_to(uint32_t offset);
 
 	void sd_card_setup();
-	void sd_dir_setup();
-	void map_current_song_to_fn();
+	void start_index();
+	bool index_step();
+	void index_walk();
+	void index_update();
+	void index_finish(bool changed);
+	void index_done(bool changed);
+	bool resume();
+	bool is_song(dir_t *p);
+
+	void pause_now();
+	void start_picked();
+	void set_level(uint8_t level);
+	void fade_step(unsigned long now);
 
 	void initPlayerStateFromEEPROM();
 	void sendSongInfo(bool first);
+	void sendProgress();
+	bool read_entry(unsigned int song, index_entry *entry);
+	bool sendLibraryEntry();
+
+	JsonHandler *handler;
+	unsigned char number;          // the player's place in players[]
+
+	// the decoder: its dreq pin, and how to set its volume. the stream sends
+	// it the song data.
+
+	unsigned char dreq_pin;
+	decoder_volume set_volume;
+	void* context;
+	bool uses_mp3;                 // it's the mp3 library's decoder
+
+	// sd_file is the song being played. next_file is the song that plays
+	// after it, opened ahead of time by prefetch_next(). when the current song
+	// ends, the two are swapped, along with their tags, so the stream buffer
+	// can carry straight on with the next song.
+
+	CachedFile sd_files[2];
+	CachedFile *sd_file, *next_file;
+	Id3Tag tags[2];
+	Id3Tag *tag, *next_tag;
+	unsigned int current_song;
+
+	StreamBuffer stream;
+
+	// info describes the frames of sd_file's audio. it's read the first time
+	// a song is seeked, and kept until sd_file changes, so seeking never
+	// rescans. info_tried is set once it's been read, so a song that isn't an
+	// mp3 (e.g. a wav file) isn't scanned again either.
+
+	Mp3Info info;
+	bool info_ready;
+	bool info_tried;
+
+	// next_song is the song in next_file, valid only while next_ready is true.
+
+	unsigned int next_song;
+	bool next_ready;
+
+	// progress collects position, state and volume changes for the client,
+	// and sends them out together (see Progress.h).
+
+	Progress progress;
+	PlayerState player;
+
+	// the player runs as a state machine, see loop().
+
+	state current_state;
+	state last_state;
+	bool repeat;
+
+	// the page of the library being sent, see sendLibrary(). once the index
+	// is up to date, the client is told which library it is, as soon as
+	// there's room for that in the ring (see sendLibraryEntry()).
+
+	unsigned int library_next, library_left;
+	bool library_announce;
+
+	// fast_boot is set by setup(). resumed is true once the song we left off
+	// with (or one picked since) has been opened. index_current is the
+	// playing song's number in the index being built. that's found by its
+	// first cluster: the open file's, or index_cluster, the one the old index
+	// gave for the song we left off with, if it couldn't be opened.
+
+	bool fast_boot;
+	bool resumed;
+	unsigned int index_current;
+	uint32_t index_cluster;
+
+	// current_folder is the playing song's folder; with folder_play set,
+	// only the songs in it are played (and repeated). open_song() sets
+	// opened_folder to the folder of the song it opened.
+
+	bool folder_play;
+	unsigned int current_folder, next_folder, opened_folder;
+	unsigned int folder_first, folder_count;
+
+	// the volume, in percent, and the level the decoder is set to, which
+	// differs from it while fading (see Fader.h). pausing is set while the
+	// song fades out for a pause, dipping while it fades out for one picked
+	// by hand, which is in sd_file by then, the old one in next_file.
+
+	uint8_t volume_percent;
+	uint8_t volume_level;
+	Fader fade;
+	bool pausing;
+	bool dipping;
+
+	//positions to keep track of % of song played. both are relative to the
+	//audio itself, so neither the id3v2 tag at the start nor an id3v1 tag at
+	//the end count towards them.
+	int currPosition;
+	uint32_t bytesPlayed;
 };
 
 #endif
\ No newline at end of file
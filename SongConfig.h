@@ -0,0 +1,224 @@
+/*
+ * Arduino Library for VS10XX Decoder & FatFs
+ * (c) 2010, David Sirkin sirkin@stanford.edu
+ */
+
+#ifndef SONGCONFIG_H
+#define SONGCONFIG_H
+
+// the sizes and limits that decide how much sram and eeprom the library takes,
+// all in one place. each one can be set for a build (e.g. -Dcache_blocks=2)
+// instead of editing the library, and the defaults depend on the board where
+// it makes a difference. what they're for is explained where they're used.
+// the checks at the end stop a build whose settings don't go together.
+//
+// Song::sendStats() reports the resulting static sram as sramStatic.
+
+// players (Song.h), i.e. decoders, sharing the one microsd card. each one
+// takes its own share of the block cache and of the player state journal.
+
+#ifndef max_players
+#define max_players       1
+#endif
+
+// block cache (BlockCache.h): 512 bytes of sram per block. teensy 2.0 (2.5k
+// of sram) only has room for one; boards with 8k or more read ahead.
+
+#ifdef __AVR__
+#include <avr/io.h>
+#endif
+
+#ifndef cache_blocks
+#if defined(RAMEND) && RAMEND >= 0x2000
+#define cache_blocks      4
+#else
+#define cache_blocks      1
+#endif
+#endif
+
+// song tags (Id3Tag.h), kept for two songs, and in every library index
+// record (LibraryIndex.h). an index written with other lengths is rebuilt.
+
+#ifndef max_title_len
+#define max_title_len     60
+#endif
+#ifndef max_artist_len
+#define max_artist_len    30
+#endif
+#ifndef max_album_len
+#define max_album_len     40
+#endif
+
+// commands and responses (JsonHandler.h, JsonWriter.h).
+
+#ifndef uart_baud
+#define uart_baud         9600
+#endif
+#ifndef max_cmd_len
+#define max_cmd_len       15
+#endif
+#ifndef max_data_len
+#define max_data_len      50
+#endif
+#ifndef max_bytes_per_read
+#define max_bytes_per_read 8
+#endif
+#ifndef tx_depth
+#define tx_depth          256    // bytes of responses queued in sram (a power of two)
+#endif
+#ifndef tx_burst
+#define tx_burst          16     // most bytes handed to the uart ahead of time
+#endif
+#ifndef json_chunk_size
+#define json_chunk_size   32     // bytes collected before the sink is called
+#endif
+#ifndef json_max_depth
+#define json_max_depth    8      // objects and arrays open at once
+#endif
+
+// the player state journals in eeprom (PlayerState.h), one per player, one
+// after the other. each slot holds an 11 byte record.
+
+#ifndef journal_start
+#define journal_start     8      // eeprom address of the first slot
+#endif
+#ifndef journal_slots
+#define journal_slots     64     // slots in each journal
+#endif
+#ifndef state_settle_ms
+#define state_settle_ms   2000   // commit once nothing changed for this long...
+#endif
+#ifndef state_max_wait_ms
+#define state_max_wait_ms 30000  // ...or this long after the first change
+#endif
+
+// progress events (Progress.h), until the client asks for others.
+
+#ifndef progress_permille
+#define progress_permille 10     // a position update every 1%...
+#endif
+#ifndef progress_interval
+#define progress_interval 250    // ...but at most one event every 250 ms
+#endif
+
+// what loop() does between decoder feeds (Song.cpp).
+
+#ifndef prefetch_window
+#define prefetch_window   16384  // bytes left in a song when the next is opened
+#endif
+#ifndef library_entry_room
+#define library_entry_room 224   // free bytes in the ring before a song is sent,
+                                 // and the most its message takes
+#endif
+#ifndef index_slice_entries
+#define index_slice_entries 16   // dir entries read per slice, one 512 byte block
+#endif
+
+// the background tasks (Scheduler.h). they only get a slice of time while the
+// decoders have enough to play for it, plus feed_watermark bytes to spare,
+// which covers the card read that comes after. how long that is depends on
+// the song's bytes per ms, which is worked out from its duration, or taken to
+// be max_bytes_per_ms if that isn't known.
+
+#ifndef max_tasks
+#define max_tasks         6      // the library's 5, and one for the sketch
+#endif
+#ifndef task_budget_us
+#define task_budget_us    8000   // background time per loop(), at most
+#endif
+#ifndef decoder_fifo
+#define decoder_fifo      2048   // the decoder's own input buffer (vs1053)
+#endif
+#ifndef feed_watermark
+#define feed_watermark    1024   // bytes kept in reserve for the decoder
+#endif
+#ifndef max_bytes_per_ms
+#define max_bytes_per_ms  176    // cd quality wav
+#endif
+
+// volume fades (Fader.h). a change of volume is ramped over volume_ramp_ms,
+// so it doesn't click.
+
+#ifndef volume_ramp_ms
+#define volume_ramp_ms    50
+#endif
+#ifndef fade_in_ms
+#define fade_in_ms        300    // on play, and on power up
+#endif
+#ifndef fade_out_ms
+#define fade_out_ms       200    // before a pause
+#endif
+#ifndef track_fade_ms
+#define track_fade_ms     100    // out and back in, when a song is picked
+#endif
+
+#if cache_blocks < 1 || cache_blocks > 127
+#error "cache_blocks must be from 1 to 127"
+#endif
+
+// every player's stream keeps a block of the cache locked.
+
+#if max_players < 1 || max_players > cache_blocks
+#error "max_players must be from 1 to cache_blocks"
+#endif
+
+// an id3v1 field (30 characters) is copied in whole, and so is a file name,
+// as the title.
+
+#if max_title_len > 254 || max_artist_len > 254 || max_album_len > 254
+#error "tag lengths must be at most 254"
+#endif
+
+#if max_title_len < 30 || max_artist_len < 30 || max_album_len < 30
+#error "tag lengths must be at least 30, the length of an id3v1 field"
+#endif
+
+#if max_cmd_len > 254 || max_data_len > 254 || json_chunk_size > 255
+#error "command lengths must be at most 254, and json_chunk_size at most 255"
+#endif
+
+// JsonWriter keeps a bit per open object or array in a byte.
+
+#if json_max_depth < 1 || json_max_depth > 8
+#error "json_max_depth must be from 1 to 8"
+#endif
+
+// the tx ring's byte counters wrap, and tx[n % tx_depth] only stays in step
+// across that if tx_depth divides their range.
+
+#if tx_depth < 1 || (tx_depth & (tx_depth - 1)) != 0
+#error "tx_depth must be a power of two"
+#endif
+
+#if tx_burst > tx_depth || library_entry_room > tx_depth
+#error "tx_burst and library_entry_room must fit in tx_depth"
+#endif
+
+// the journal finds the newest record by its 8 bit sequence number, which
+// mustn't come round again within the journal.
+
+#if journal_slots < 2 || journal_slots > 255
+#error "journal_slots must be from 2 to 255"
+#endif
+
+#if defined(E2END) && journal_start + max_players * journal_slots * 11 > E2END + 1
+#error "the player state journals don't fit in eeprom"
+#endif
+
+#if state_settle_ms > state_max_wait_ms
+#error "state_settle_ms must be at most state_max_wait_ms"
+#endif
+
+#if index_slice_entries < 1
+#error "index_slice_entries must be at least 1"
+#endif
+
+#if max_tasks < 5 || max_tasks > 255
+#error "max_tasks must be from 5 (the library's own) to 255"
+#endif
+
+#if feed_watermark >= decoder_fifo
+#error "feed_watermark must be less than decoder_fifo"
+#endif
+
+#endif
@@ -0,0 +1,122 @@
+#include <JsonHandler.h>
+#include <Stats.h>
+
+#ifdef SONG_STATS
+
+Stats stats;
+
+Stats::Stats(){
+	first_audio_ms = 0;
+	indexed_ms = 0;
+	reset();
+}
+
+void Stats::reset(){
+	loops = 0;
+	loop_us = 0;
+	loop_max_us = 0;
+	for (unsigned char i = 0; i < stats_buckets; i++) {
+		sd_reads[i] = 0;
+	}
+	sd_max_us = 0;
+	scans = 0;
+	scan_us = 0;
+	opens = 0;
+	open_max_us = 0;
+	feed_us = 0;
+	uart_blocked_us = 0;
+	bytes = 0;
+	eeprom_writes = 0;
+	index_slices = 0;
+	index_slice_max_us = 0;
+}
+
+void Stats::loopTime(unsigned long us){
+	loops++;
+	loop_us += us;
+	if (us > loop_max_us) loop_max_us = us;
+}
+
+void Stats::sdRead(unsigned long us){
+	unsigned char b = 0;
+	for (unsigned long limit = stats_bucket_us; us >= limit && b < stats_buckets - 1; limit <<= 1) {
+		b++;
+	}
+	sd_reads[b]++;
+	if (us > sd_max_us) sd_max_us = us;
+}
+
+void Stats::scanTime(unsigned long us){
+	scans++;
+	scan_us += us;
+}
+
+void Stats::openTime(unsigned long us){
+	opens++;
+	if (us > open_max_us) open_max_us = us;
+}
+
+// the whole of StreamBuffer::feed(): polling dreq as well as sending the
+// data. feed() never waits for dreq, so this is the decoder's share of
+// loop(), not time spent waiting on it.
+
+void Stats::feedTime(unsigned long us){
+	feed_us += us;
+}
+
+void Stats::uartBlocked(unsigned long us){
+	uart_blocked_us += us;
+}
+
+void Stats::streamed(unsigned int n){
+	bytes += n;
+}
+
+void Stats::eepromWrite(){
+	eeprom_writes++;
+}
+
+void Stats::indexSlice(unsigned long us){
+	index_slices++;
+	if (us > index_slice_max_us) index_slice_max_us = us;
+}
+
+void Stats::firstAudio(unsigned long ms){
+	if (first_audio_ms == 0) first_audio_ms = ms;
+}
+
+void Stats::indexed(unsigned long ms){
+	if (indexed_ms == 0) indexed_ms = ms;
+}
+
+// add the statistics to the response being built. times are in microseconds.
+
+void Stats::report(JsonHandler* handler){
+	handler->addKeyValuePair("loops", loops);
+	handler->addKeyValuePair("loopAvgUs", loops ? loop_us / loops : 0);
+	handler->addKeyValuePair("loopMaxUs", loop_max_us);
+
+	handler->beginArray("sdReadUs");
+	for (unsigned char i = 0; i < stats_buckets; i++) {
+		handler->addKeyValuePair("", sd_reads[i]);
+	}
+	handler->end();
+	handler->addKeyValuePair("sdReadMaxUs", sd_max_us);
+
+	handler->addKeyValuePair("scans", scans);
+	handler->addKeyValuePair("scanAvgUs", scans ? scan_us / scans : 0);
+	handler->addKeyValuePair("opens", opens);
+	handler->addKeyValuePair("openMaxUs", open_max_us);
+
+	handler->addKeyValuePair("feedUs", feed_us);
+	handler->addKeyValuePair("bytesStreamed", bytes);
+	handler->addKeyValuePair("uartBlockedUs", uart_blocked_us);
+	handler->addKeyValuePair("eepromWrites", eeprom_writes);
+
+	handler->addKeyValuePair("indexSlices", index_slices);
+	handler->addKeyValuePair("indexSliceMaxUs", index_slice_max_us);
+	handler->addKeyValuePair("firstAudioMs", first_audio_ms);
+	handler->addKeyValuePair("indexedMs", indexed_ms);
+}
+
+#endif
@@ -0,0 +1,88 @@
+/*
+ * Arduino Library for VS10XX Decoder & FatFs
+ * (c) 2010, David Sirkin sirkin@stanford.edu
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+// runtime statistics, for finding out why a player stutters: how long loop()
+// takes, how long microsd reads take, how long feeding the decoder and
+// waiting on the uart take, and so on. Song::sendStats() reports them as a
+// STATS response.
+//
+// they cost a micros() call or two per loop(), so they're left out unless
+// SONG_STATS is defined. without it, STAT() compiles to nothing, and STATS
+// only reports the counters that are kept anyway (underruns, uart bytes).
+
+//#define SONG_STATS
+
+#ifdef SONG_STATS
+#define STAT(x) x
+#else
+#define STAT(x)
+#endif
+
+// sd read times go into a histogram with power of two buckets: bucket 0 is
+// under 256 us, bucket 1 under 512 us, and so on. the last bucket takes
+// everything from 16 ms up.
+
+#define stats_buckets   8
+#define stats_bucket_us 256
+
+class JsonHandler;
+
+class Stats
+{
+  public:
+	Stats();
+	void reset();
+
+	void loopTime(unsigned long us);
+	void sdRead(unsigned long us);
+	void scanTime(unsigned long us);
+	void openTime(unsigned long us);
+	void feedTime(unsigned long us);
+	void uartBlocked(unsigned long us);
+	void streamed(unsigned int bytes);
+	void eepromWrite();
+	void indexSlice(unsigned long us);
+	void firstAudio(unsigned long ms);
+	void indexed(unsigned long ms);
+
+	void report(JsonHandler* handler);
+  private:
+	unsigned long loops;
+	unsigned long loop_us;         // loop() time, summed for the average
+	unsigned long loop_max_us;
+
+	unsigned long sd_reads[stats_buckets];
+	unsigned long sd_max_us;
+
+	unsigned long scans;
+	unsigned long scan_us;
+	unsigned long opens;
+	unsigned long open_max_us;
+
+	unsigned long feed_us;         // time in feed(): polling dreq and sending
+	unsigned long uart_blocked_us; // time spent waiting for room in the tx ring
+	unsigned long bytes;           // bytes sent to the decoder
+	unsigned long eeprom_writes;
+	unsigned long index_slices;
+	unsigned long index_slice_max_us;
+
+	// when the first audio went to the decoder, and when the library index
+	// was up to date, in millis() since the board started. these are only
+	// set once, so reset() leaves them alone.
+
+	unsigned long first_audio_ms;
+	unsigned long indexed_ms;
+};
+
+#ifdef SONG_STATS
+extern Stats stats;
+#endif
+
+#endif
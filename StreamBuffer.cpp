@@ -0,0 +1,263 @@
+#include <SD.h>
+#include <StreamBuffer.h>
+#include <Stats.h>
+
+#if cache_block_size % dreq_chunk != 0
+#error "cache_block_size must be a multiple of dreq_chunk"
+#endif
+
+StreamBuffer::StreamBuffer(){
+	play = NULL;
+	context = NULL;
+	underruns = 0;
+	data = NULL;
+	reset(NULL, 0, 0);
+}
+
+// throw away whatever is buffered, e.g. when a new song is opened or the
+// current one is seeked. from now on, sd_file is sent from offset up to end,
+// which lets us leave out an id3v1 tag at the end of the file. the underrun
+// counter survives, it's a lifetime stat.
+
+void StreamBuffer::reset(CachedFile* sd_file, uint32_t offset, uint32_t end){
+	block_cache.unlock(data);
+	file = sd_file;
+	cluster = sd_file ? sd_file->firstCluster() : 0;
+	pos = offset;
+	this->end = end;
+	data = NULL;
+	ahead = 0;
+	chained = false;
+	primed = false;
+	starved = false;
+	frames.begin(offset);
+}
+
+// the decoder's fifo ran dry while nothing was sent on purpose (paused).
+// like after a reset, it has to fill up again before underruns count.
+
+void StreamBuffer::resume(){
+	primed = false;
+	starved = false;
+}
+
+// a fill is due when the block pos is in isn't cached, or when there's room
+// in the stream's share of the cache to read ahead, the blocks read ahead last time are used up,
+// and there's more to read.
+
+bool StreamBuffer::needsFill(){
+	if (data == NULL) return pos < end || chained;
+	return stream_blocks > 1 && ahead == 0 &&
+	       (chained || (pos / cache_block_size + 1) * cache_block_size < end);
+}
+
+// get the block pos is in (from the cache, or microsd) and lock it, and
+// with room in the stream's share of the cache, read the blocks after it
+// ahead: this song's next ones, and then those of the song chained after it.
+// so a call reads at most stream_blocks blocks, and for a contiguous file, that's a single multi-block
+// read. returns the number of bytes that became ready.
+
+unsigned int StreamBuffer::fill(){
+	unsigned int got = 0;
+
+	if (data == NULL && pos >= end && chained) start_chained();
+	if (data == NULL) {
+		if (pos >= end) return 0;
+		data = block_cache.get(file, pos / cache_block_size, &data_len);
+
+		// a block that can't be read only happens on a card error, which we
+		// treat as the end of the song, so that playback moves on.
+
+		if (data == NULL || pos % cache_block_size >= data_len) {
+			block_cache.stop();
+			data = NULL;
+			end = pos;
+			return 0;
+		}
+		block_cache.lock(data);
+		got = data_len;
+	}
+
+	if (stream_blocks > 1 && ahead == 0) {
+		CachedFile* f = file;
+		uint32_t block = pos / cache_block_size;
+		uint32_t f_end = end;
+		bool in_next = false;
+
+		for (unsigned char i = 1; i < stream_blocks; i++) {
+			if (++block * cache_block_size >= f_end) {
+				if (!chained || in_next) break;
+				f = next_file;
+				block = next_pos / cache_block_size;
+				f_end = next_end;
+				in_next = true;
+			}
+			if (!block_cache.readAhead(f, block)) break;
+			ahead++;
+			got += cache_block_size;
+		}
+	}
+
+	block_cache.stop();
+	return got;
+}
+
+// carry on with sd_file from offset (up to end) once the current file has
+// been sent to its end. used for gapless song changes. only chain once
+// atEof(): the rest of the current file is then in the locked block, so its
+// SdFile can be closed and used for something else.
+
+void StreamBuffer::chain(CachedFile* sd_file, uint32_t offset, uint32_t end){
+	chained = true;
+	next_file = sd_file;
+	next_pos = offset;
+	next_end = end;
+	ahead = 0;
+}
+
+// throw away whatever is buffered, and send nothing more until the next
+// reset(). this unlocks the block that was being sent from.
+
+void StreamBuffer::stop(){
+	block_cache.unlock(data);
+	data = NULL;
+	end = pos;
+	chained = false;
+}
+
+// send 32 byte chunks to the decoder for as long as dreq stays high, up to
+// the end of the locked block, or of the next one if it was read ahead. the
+// last chunk of a file may be short. returns the number of bytes sent.
+//
+// the decoder has its own 2k fifo, which swallows a couple of blocks right
+// after a reset. so only once dreq has dropped (the fifo is full) does having
+// nothing at all to send with dreq high count as an underrun, and then once
+// per episode.
+
+unsigned int StreamBuffer::feed(unsigned char dreq_pin){
+	unsigned int sent = 0;
+	bool wanted = false;
+	STAT(unsigned long started = micros();)
+
+	while (true) {
+		if (!digitalRead(dreq_pin)) {
+			primed = true;
+			break;
+		}
+
+		if (pos >= end && chained) start_chained();
+		if (data == NULL || pos >= end) {
+			wanted = true;
+			break;
+		}
+
+		unsigned int off = pos % cache_block_size;
+		unsigned int n = dreq_chunk;
+		if (n > data_len - off) n = data_len - off;
+		if (n > end - pos) n = end - pos;
+
+		play(context, data + off, n);
+		frames.sent(data + off, n);
+		pos += n;
+		sent += n;
+
+		if (pos >= end) {
+			block_cache.unlock(data);
+			data = NULL;
+		}
+		else if (off + n == data_len) {
+			next_block();
+		}
+	}
+
+	if (sent) {
+		starved = false;
+	}
+	else if (wanted && primed && !starved && !finished()) {
+		underruns++;
+		starved = true;
+	}
+
+	STAT(stats.feedTime(micros() - started);)
+	STAT(stats.streamed(sent);)
+	return sent;
+}
+
+// the end of the old song has been sent: go on with the one chained after it.
+
+void StreamBuffer::start_chained(){
+	file = next_file;
+	cluster = file->firstCluster();
+	pos = next_pos;
+	end = next_end;
+	chained = false;
+	frames.begin(pos);
+	next_block();
+}
+
+// done with the block that was locked: move on to the one pos is in now, if
+// it's cached already (i.e. it was read ahead). if not, the next fill() reads
+// it, and reads ahead again.
+
+void StreamBuffer::next_block(){
+	block_cache.unlock(data);
+	data = block_cache.find(cluster, pos / cache_block_size, &data_len);
+	if (data) {
+		block_cache.lock(data);
+		if (ahead) ahead--;
+	}
+	else {
+		ahead = 0;
+	}
+}
+
+// the decoder the stream sends to: play is called with context and each chunk.
+
+void StreamBuffer::setDecoder(decoder_data play, void* context){
+	this->play = play;
+	this->context = context;
+}
+
+// roughly how many bytes can still be sent before the card has to be read:
+// the rest of the locked block, and the blocks read ahead after it.
+
+uint32_t StreamBuffer::buffered(){
+	if (data == NULL || pos >= end) return 0;
+
+	uint32_t left = data_len - pos % cache_block_size + (uint32_t) ahead * cache_block_size;
+	return (chained || left < end - pos) ? left : end - pos;
+}
+
+// the offset of the last frame sent to the decoder (see FrameTracker.h). while
+// the end of the previous song is still going out, that's the start of the
+// next one.
+
+uint32_t StreamBuffer::getFrame(){
+	return chained ? next_pos : frames.getFrame();
+}
+
+// how far the current song has been sent. like getFrame(), that's the start of
+// the next song while the end of the previous one is going out.
+
+uint32_t StreamBuffer::position(){
+	return chained ? next_pos : pos;
+}
+
+// true when the rest of the file is in the locked block (but maybe not all
+// sent yet), i.e. nothing more will be read from it.
+
+bool StreamBuffer::atEof(){
+	if (chained) return false;
+	if (pos >= end) return true;
+	return data != NULL && (end - 1) / cache_block_size == pos / cache_block_size;
+}
+
+// true when the file has been sent to the end.
+
+bool StreamBuffer::finished(){
+	return !chained && pos >= end;
+}
+
+unsigned long StreamBuffer::getUnderruns(){
+	return underruns;
+}
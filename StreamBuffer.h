@@ -0,0 +1,82 @@
+/*
+ * Arduino Library for VS10XX Decoder & FatFs
+ * (c) 2010, David Sirkin sirkin@stanford.edu
+ */
+
+#ifndef STREAMBUFFER_H
+#define STREAMBUFFER_H
+
+#include <SD.h>
+#include <BlockCache.h>
+#include <FrameTracker.h>
+
+// the stream buffer sits between the microsd card and the decoder. it sends
+// song data straight from the block cache (see BlockCache.h), from a block
+// it keeps locked until it's all sent, and reads the next block (and, with
+// room in the cache, the one after, ahead of time) when it runs out. the
+// decoder side drains it in 32 byte chunks, but only while the decoder's dreq
+// line says it can take them. that way a slow card read never leaves the
+// decoder waiting on a half-sent chunk. what's sent is followed by a frame
+// tracker, for resuming on a frame.
+
+// cache_block_size must be a multiple of dreq_chunk, so that a chunk never
+// straddles two blocks.
+
+#define dreq_chunk        32     // the decoder accepts 32 bytes per dreq
+
+// the blocks of the cache one stream may use: the locked one, and those read
+// ahead after it. with more than one player, each gets an equal share.
+
+#define stream_blocks     (cache_blocks / max_players)
+
+// how the stream hands a chunk to its decoder (see Song.h). the chunk is at
+// most dreq_chunk bytes.
+
+typedef void (*decoder_data)(void* context, unsigned char* data, unsigned char len);
+
+class StreamBuffer
+{
+  public:
+	StreamBuffer();
+	void reset(CachedFile* sd_file, uint32_t offset, uint32_t end);
+	bool needsFill();
+	unsigned int fill();
+	void chain(CachedFile* sd_file, uint32_t offset, uint32_t end);
+	void stop();
+	void resume();
+	unsigned int feed(unsigned char dreq_pin);
+	void setDecoder(decoder_data play, void* context);
+	uint32_t buffered();
+	uint32_t getFrame();
+	uint32_t position();
+	bool atEof();
+	bool finished();
+	unsigned long getUnderruns();
+  private:
+	void start_chained();
+	void next_block();
+
+	decoder_data play;
+	void* context;
+	CachedFile* file;            // the file being sent...
+	uint32_t cluster;            // ...its first cluster, which names its blocks
+	uint32_t pos;                // file offset of the next byte to send
+	uint32_t end;                // stop sending here
+	unsigned char* data;         // the (locked) block pos is in, if cached
+	unsigned int data_len;
+	unsigned char ahead;         // blocks after it read ahead, not yet used
+	bool primed;                 // the decoder's own fifo has filled up once
+	bool starved;                // the decoder asked for data we didn't have
+	unsigned long underruns;
+
+	// the song chained after this one, see chain().
+
+	bool chained;
+	CachedFile* next_file;
+	uint32_t next_pos;
+	uint32_t next_end;
+
+	FrameTracker frames;
+};
+
+#endif
@@ -0,0 +1,100 @@
+// the cost of reading each song's tag on a card, the way the library's index
+// scan does for a new or changed song, with Id3Tag and with the scanner it
+// replaced (legacy/OldId3Tag).
+//
+//   bench [-tags] [dir]
+//
+// reads the songs in dir ($SDROOT by default, e.g. the card corpus -tags
+// writes) and prints a table. its last column says whether the old scanner
+// read the same title, artist and album as Id3Tag does. with -tags it prints
+// what Id3Tag read from each song instead: name|title|artist|album|audio
+// start|audio end|duration.
+
+#include <SD.h>
+#include <CachedFile.h>
+#include <Id3Tag.h>
+#include <LibraryIndex.h>
+#include <Mp3Info.h>
+#include <OldId3Tag.h>
+#include <host.h>
+
+// OldId3Tag falls back on the file's name, in fn, as the sketch once kept it.
+
+char fn[max_name_len];
+
+struct Cost {
+	unsigned long reads, bytes, seeks;
+	unsigned long long us;
+};
+
+static Cost since(const Cost& start) {
+	Cost c = { sd_reads - start.reads, sd_bytes - start.bytes, sd_seeks - start.seeks, sim_us - start.us };
+	return c;
+}
+
+static Cost now() {
+	Cost c = { sd_reads, sd_bytes, sd_seeks, sim_us };
+	return c;
+}
+
+int main(int argc, char** argv) {
+	bool tags = argc > 1 && !strcmp(argv[1], "-tags");
+	if (argc > 1 + tags) setenv("SDROOT", argv[1 + tags], 1);
+
+	Sd2Card card;
+	SdVolume volume;
+	SdFile root;
+	dir_t p;
+	char name[13];
+
+	card.init(SPI_FULL_SPEED, SS_PIN);
+	volume.init(card);
+	root.openRoot(&volume);
+
+	if (!tags) {
+		printf("%-12s %19s %19s\n", "", "---- Id3Tag ----", "--- OldId3Tag ---");
+		printf("%-12s %5s %6s %6s %5s %6s %6s  %s\n",
+			"song", "reads", "bytes", "ms", "reads", "bytes", "ms", "tags");
+	}
+	while (root.readDir(&p) > 0 && p.name[0] != DIR_NAME_FREE) {
+		if (!DIR_IS_FILE(&p) || (memcmp(p.name + 8, "MP3", 3) && memcmp(p.name + 8, "WAV", 3))) continue;
+
+		uint16_t index = root.curPosition() / sizeof(dir_t) - 1;
+		CachedFile file;
+		Id3Tag tag;
+		OldId3Tag old_tag;
+
+		// the scanners fall back on the file's name.
+
+		LibraryIndex::formatName((char*) p.name, name);
+		strcpy(fn, name);
+		file.open(&root, index, O_READ);
+
+		Cost start = now();
+		tag.scan(&file, name);
+		Cost cost = since(start);
+
+		start = now();
+		old_tag.scan(&file);
+		Cost old_cost = since(start);
+
+		if (tags) {
+			Mp3Info info;
+			info.analyze(&file, tag.getAudioStart(), tag.getAudioEnd());
+			printf("%s|%s|%s|%s|%lu|%lu|%lu\n", name, tag.getTitle(), tag.getArtist(),
+				tag.getAlbum(), (unsigned long) tag.getAudioStart(),
+				(unsigned long) tag.getAudioEnd(), (unsigned long) info.getDuration());
+		}
+		file.close();
+		if (tags) continue;
+
+		bool same = !strcmp(tag.getTitle(), old_tag.getTitle()) &&
+			!strcmp(tag.getArtist(), old_tag.getArtist()) &&
+			!strcmp(tag.getAlbum(), old_tag.getAlbum());
+		printf("%-12s %5lu %6lu %6.1f %5lu %6lu %6.1f  %s\n", name,
+			cost.reads, cost.bytes, cost.us / 1000.0,
+			old_cost.reads, old_cost.bytes, old_cost.us / 1000.0,
+			same ? "same" : "differ");
+	}
+	return 0;
+}
@@ -0,0 +1,260 @@
+// writes a test card of songs, SONG00.MP3 and up (SONG000.MP3 and up for
+// more than 100, so that they sort in order). the audio is 128 kbit/s 44.1 kHz
+// stereo frames (417 bytes, about 26 ms each) of pseudo-random data, the same
+// on every run. so are the files' write stamps, which go into the library's
+// checksum (and from there into what it sends).
+//
+//   corpus <dir> [songs [frames [art]]]
+//   corpus -tags <dir> [frames]
+//   corpus -folders <dir> [frames]
+//
+// 3 songs of 300 frames (about 8 s) each by default. with art, each song
+// starts with an id3v2.3 tag: title, artist, album and a cover picture of
+// art bytes. without it they're untagged.
+//
+// with -tags it writes one song for each kind of tag the library reads
+// instead, each with the same audio, so a change in the scan cost shows which
+// tag it's down to (tags.expected lists what should be read from them). one
+// of them, B24, starts with a xing header; I23's cover picture is bigger than
+// its audio, and WPCM is a wav file of the same length.
+//
+// with -folders it writes songs in nested folders instead, titled by where
+// they are: ROOT in the root, then ARTIST1/ALBUM1 (two songs), ARTIST1/ALBUM2
+// and ARTIST2 (one each), and an EMPTY folder. the library numbers those
+// folders 0 to 5, in that order.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <utime.h>
+
+typedef std::string bytes;
+
+static unsigned long seed = 1;
+
+static bytes noise(size_t n) {
+	bytes b(n, 0);
+	for (size_t i = 0; i < n; i++) {
+		seed = seed * 1103515245 + 12345;
+		b[i] = (char)(seed >> 16);
+	}
+	return b;
+}
+
+static bytes be32(unsigned long n) {
+	bytes b(4, 0);
+	for (int i = 0; i < 4; i++) b[i] = (char)(n >> (24 - 8 * i));
+	return b;
+}
+
+static bytes syncsafe(unsigned long n) {
+	bytes b(4, 0);
+	for (int i = 0; i < 4; i++) b[i] = (char)((n >> (21 - 7 * i)) & 0x7f);
+	return b;
+}
+
+static bytes utf16(const char* s) {
+	bytes b("\xff\xfe", 2);
+	for (; *s; s++) { b += *s; b += '\0'; }
+	return b;
+}
+
+// put a 0 after every 0xff that's followed by 0, by 0xe0 or more, or by
+// nothing, as id3v2 unsynchronisation does.
+
+static bytes unsynchronise(const bytes& b) {
+	bytes u;
+	for (size_t i = 0; i < b.size(); i++) {
+		u += b[i];
+		if ((unsigned char) b[i] == 0xff &&
+		    (i + 1 == b.size() || b[i + 1] == 0 || (unsigned char) b[i + 1] >= 0xe0)) {
+			u += '\0';
+		}
+	}
+	return u;
+}
+
+// text frames, for each tag version
+
+static bytes frame22(const char* id, const char* text) {
+	bytes body = bytes(1, '\0') + text;
+	return id + be32(body.size()).substr(1) + body;
+}
+
+static bytes frame23(const char* id, const std::string& text, bool unicode = false) {
+	bytes body = unicode ? bytes(1, '\1') + utf16(text.c_str()) : bytes(1, '\0') + text;
+	return id + be32(body.size()) + bytes(2, '\0') + body;
+}
+
+// format is the second byte of an id3v2.4 frame's flags: 0x40 grouped,
+// 0x08 compressed (the body is just noise here), 0x02 unsynchronised, 0x01
+// with a data length indicator.
+
+static bytes frame24(const char* id, const char* text, unsigned char format = 0, char enc = '\3') {
+	bytes body = bytes(1, enc) + text;
+	bytes head;
+	if (format & 0x40) head += '\1';
+	if (format & 0x01) head += syncsafe(body.size());
+	if (format & 0x08) body = noise(body.size());
+	if (format & 0x02) body = unsynchronise(body);
+	body = head + body;
+	return id + syncsafe(body.size()) + bytes(1, '\0') + bytes(1, (char) format) + body;
+}
+
+static bytes picture23(size_t n) {
+	bytes head("\0image/jpeg\0\3\0", 14);
+	return "APIC" + be32(n) + bytes(2, '\0') + head + noise(n - head.size());
+}
+
+static bytes picture24(size_t n) {
+	bytes head("\0image/jpeg\0\3\0", 14);
+	return "APIC" + syncsafe(n) + bytes(2, '\0') + head + noise(n - head.size());
+}
+
+static bytes tag2(int version, const bytes& frames, bool unsync = false) {
+	bytes body = (unsync ? unsynchronise(frames) : frames) + bytes(64, '\0');
+	return "ID3" + bytes(1, (char) version) + bytes(1, '\0') + bytes(1, unsync ? '\x80' : '\0') +
+		syncsafe(body.size()) + body;
+}
+
+static bytes tag1(const char* title, const char* artist, const char* album) {
+	bytes b = "TAG";
+	b += bytes(title) + bytes(30 - strlen(title), '\0');
+	b += bytes(artist) + bytes(30 - strlen(artist), '\0');
+	b += bytes(album) + bytes(30 - strlen(album), '\0');
+	return b + "2011" + bytes(31, '\0');
+}
+
+// mpeg 1 layer 3, 128 kbit/s, 44.1 kHz, stereo, no padding
+
+static const bytes frame_header("\xff\xfb\x90\x00", 4);
+
+static bytes audio(unsigned long frames, bool xing = false) {
+	bytes b;
+	if (xing) {
+		bytes f = frame_header + bytes(413, '\0');
+		f.replace(36, 4, "Xing");
+		f.replace(40, 4, be32(15));
+		f.replace(44, 4, be32(frames));
+		f.replace(48, 4, be32(frames * 417 + 417));
+		for (int i = 0; i < 100; i++) f[52 + i] = (char)(i * 256 / 100);
+		b += f;
+	}
+	for (unsigned long i = 0; i < frames; i++) b += frame_header + noise(413);
+	return b;
+}
+
+static bytes le(unsigned long n, int size) {
+	bytes b(size, 0);
+	for (int i = 0; i < size; i++) b[i] = (char)(n >> (8 * i));
+	return b;
+}
+
+// 8 bit mono pcm at 16 kHz, which is as many bytes a second as the frames.
+
+static bytes wav(unsigned long frames) {
+	bytes data = noise(frames * 417);
+	bytes fmt = le(1, 2) + le(1, 2) + le(16000, 4) + le(16000, 4) + le(1, 2) + le(8, 2);
+	return "RIFF" + le(36 + data.size(), 4) + "WAVE" + "fmt " + le(fmt.size(), 4) + fmt +
+		"data" + le(data.size(), 4) + data;
+}
+
+static bool save(const std::string& dir, const std::string& name, const bytes& b) {
+	std::string path = dir + "/" + name;
+	FILE* f = fopen(path.c_str(), "wb");
+	if (!f || fwrite(b.data(), 1, b.size(), f) != b.size()) {
+		fprintf(stderr, "can't write %s\n", path.c_str());
+		return false;
+	}
+	fclose(f);
+
+	struct utimbuf stamp = { 1577836800, 1577836800 };   // 2020-01-01
+	utime(path.c_str(), &stamp);
+	return true;
+}
+
+static int tags(const std::string& dir, unsigned long n) {
+	bool ok = true;
+
+	mkdir(dir.c_str(), 0777);
+	ok &= save(dir, "A23.MP3", tag2(3, frame23("TIT2", "Song \"Twenty\" Three") +
+		frame23("TPE1", "Artist A") + picture23(20000) + frame23("TALB", "Album A")) + audio(n));
+	ok &= save(dir, "B24.MP3", tag2(4, frame24("TIT2", "V24 Title") +
+		frame24("TPE1", "V24 Artist") + frame24("TALB", "V24 Album")) + audio(n, true));
+	ok &= save(dir, "C22.MP3", tag2(2, frame22("TT2", "V22 Title") +
+		frame22("TP1", "V22 Artist") + frame22("TAL", "V22 Album")) + audio(n));
+	ok &= save(dir, "D16.MP3", tag2(3, frame23("TIT2", "Unicode Title", true) +
+		frame23("TPE1", "Uni Artist", true) + frame23("TALB", "Uni Album", true)) + audio(n));
+	ok &= save(dir, "EV1.MP3", audio(n) + tag1("V1 Title", "V1 Artist", "V1 Alb\xfcm"));
+	ok &= save(dir, "FNONE.MP3", audio(n));
+	ok &= save(dir, "G24.MP3", tag2(4, frame24("TALB", "Compressed", 0x09) +
+		frame24("TIT2", "Grouped Title", 0x40) + picture24(2000) +
+		frame24("TPE1", "Artist \xff\xff", 0x03, '\0') + frame24("TALB", "G24 Album")) + audio(n));
+	ok &= save(dir, "H16.MP3", tag2(3, "TIT2" + be32(2) + bytes(2, '\0') + "\1\xff" +
+		frame23("TPE1", "H16 Artist", true) + frame23("TALB", "H16 Album", true)) + audio(n));
+	ok &= save(dir, "U23.MP3", tag2(3, frame23("TIT2", "U23 Title") + picture23(2000) +
+		frame23("TPE1", "U23 Artist") + frame23("TALB", "U23 Album"), true) + audio(n));
+	ok &= save(dir, "I23.MP3", tag2(3, frame23("TIT2", "I23 Title") + picture23(200000) +
+		frame23("TPE1", "I23 Artist") + frame23("TALB", "I23 Album")) + audio(n));
+	ok &= save(dir, "WPCM.WAV", wav(n));
+	ok &= save(dir, "README.TXT", "x");
+	return ok ? 0 : 1;
+}
+
+static bool titled(const std::string& dir, const std::string& name, unsigned long n) {
+	std::string title = name.substr(0, name.find('.'));
+	return save(dir, name, tag2(3, frame23("TIT2", title)) + audio(n));
+}
+
+static int folders(const std::string& dir, unsigned long n) {
+	bool ok = true;
+
+	mkdir(dir.c_str(), 0777);
+	mkdir((dir + "/ARTIST1").c_str(), 0777);
+	mkdir((dir + "/ARTIST1/ALBUM1").c_str(), 0777);
+	mkdir((dir + "/ARTIST1/ALBUM2").c_str(), 0777);
+	mkdir((dir + "/ARTIST2").c_str(), 0777);
+	mkdir((dir + "/EMPTY").c_str(), 0777);
+	ok &= titled(dir, "ROOT.MP3", n);
+	ok &= titled(dir + "/ARTIST1/ALBUM1", "A1S1.MP3", n);
+	ok &= titled(dir + "/ARTIST1/ALBUM1", "A1S2.MP3", n);
+	ok &= titled(dir + "/ARTIST1/ALBUM2", "A2S1.MP3", n);
+	ok &= titled(dir + "/ARTIST2", "B1.MP3", n);
+	return ok ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+	if (argc > 2 && !strcmp(argv[1], "-tags")) {
+		return tags(argv[2], argc > 3 ? atol(argv[3]) : 300);
+	}
+	if (argc > 2 && !strcmp(argv[1], "-folders")) {
+		return folders(argv[2], argc > 3 ? atol(argv[3]) : 300);
+	}
+	if (argc < 2) {
+		fprintf(stderr, "usage: corpus <dir> [songs [frames [art]]]\n"
+			"       corpus -tags <dir> [frames]\n"
+			"       corpus -folders <dir> [frames]\n");
+		return 2;
+	}
+	std::string dir = argv[1];
+	int songs = argc > 2 ? atoi(argv[2]) : 3;
+	unsigned long frames = argc > 3 ? atol(argv[3]) : 300;
+	size_t art = argc > 4 ? atol(argv[4]) : 0;
+	bool ok = true;
+
+	mkdir(dir.c_str(), 0777);
+	for (int i = 0; i < songs; i++) {
+		char name[13], title[16];
+		sprintf(name, songs > 100 ? "SONG%03d.MP3" : "SONG%02d.MP3", i);
+		sprintf(title, "Song %d", i);
+		bytes tag;
+		if (art >= 14) {
+			tag = tag2(3, frame23("TIT2", title) +
+				frame23("TPE1", "Corpus") + frame23("TALB", "Host") + picture23(art));
+		}
+		ok &= save(dir, name, tag + audio(frames));
+	}
+	return ok ? 0 : 1;
+}
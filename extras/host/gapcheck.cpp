@@ -0,0 +1,98 @@
+// checks what a sim run sent to the decoder ($DECODED) against the songs it
+// should have played, back to back.
+//
+//   gapcheck <decoded> <song> ...
+//
+// the decoded stream has to be the songs' audio (without their id3 tags)
+// one after the other, byte for byte, with nothing left out or in between
+// at the boundaries. the run may stop partway into the last song, but every
+// song before it has to be there in full. it exits 1 if not.
+
+#include <stdio.h>
+#include <string.h>
+
+// where a song's audio starts and ends: after its id3v2 tag (and footer),
+// and before its id3v1 tag, if it has them.
+
+static void audio(FILE* song, long* start, long* end) {
+	unsigned char h[10];
+
+	*start = 0;
+	if (fread(h, 1, 10, song) == 10 && !memcmp(h, "ID3", 3)) {
+		*start = 10 + ((long) h[6] << 21) + ((long) h[7] << 14) + ((long) h[8] << 7) + h[9];
+		if (h[5] & 0x10) *start += 10;
+	}
+
+	fseek(song, 0, SEEK_END);
+	*end = ftell(song);
+	if (*end >= 128) {
+		fseek(song, *end - 128, SEEK_SET);
+		if (fread(h, 1, 3, song) == 3 && !memcmp(h, "TAG", 3)) *end -= 128;
+	}
+	fseek(song, *start, SEEK_SET);
+}
+
+// how many bytes of song the decoded stream carries on with, and whether it
+// ran out (rather than differed) where it stopped.
+
+static long compare(FILE* decoded, FILE* song, long size, bool* ended) {
+	long n = 0;
+	int c, d;
+
+	*ended = false;
+	while (n < size && (c = getc(song)) != EOF) {
+		if ((d = getc(decoded)) != c) {
+			*ended = d == EOF;
+			return n;
+		}
+		n++;
+	}
+	return -1;
+}
+
+int main(int argc, char** argv) {
+	if (argc < 3) {
+		fprintf(stderr, "usage: gapcheck <decoded> <song> ...\n");
+		return 2;
+	}
+
+	FILE* decoded = fopen(argv[1], "rb");
+	long offset = 0;
+
+	if (!decoded) {
+		perror(argv[1]);
+		return 2;
+	}
+	for (int i = 2; i < argc; i++) {
+		FILE* song = fopen(argv[i], "rb");
+		bool ended;
+
+		if (!song) {
+			perror(argv[i]);
+			return 2;
+		}
+		long start, end;
+		audio(song, &start, &end);
+		long size = end - start;
+		long n = compare(decoded, song, size, &ended);
+		fclose(song);
+
+		if (n >= 0 && !ended) {
+			printf("%s: differs at byte %ld (decoded byte %ld)\n",
+				argv[i], n, offset + n);
+			return 1;
+		}
+		if (n >= 0) {
+			// the run ended partway into this song.
+			printf("%s: %ld bytes, then the run ended\n", argv[i], n);
+			return i == 2 ? 1 : 0;
+		}
+		printf("%s: %ld bytes, in full\n", argv[i], size);
+		offset += size;
+	}
+	if (getc(decoded) != EOF) {
+		printf("%s: more than the songs after byte %ld\n", argv[1], offset);
+		return 1;
+	}
+	return 0;
+}
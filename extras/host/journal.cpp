@@ -0,0 +1,181 @@
+// what the player state journal (PlayerState) costs the eeprom, and whether
+// it reads back what it should.
+//
+//   journal
+//
+// plays a session's worth of changes and counts the eeprom writes, then
+// commits a thousand times and reports the most any one cell was written.
+// it also checks that a record cut short by a power loss, and leftovers of
+// an older layout, aren't taken for the state, that an older record's volume
+// level is read as a percent, and (in journal_players) that a second
+// player's journal keeps to itself. it exits 1 if a check fails.
+
+#include <EEPROM.h>
+#include <PlayerState.h>
+#include <Fader.h>
+#include <host.h>
+
+#define states 3                   // DIR_PLAY, MP3_PLAY and IDLE, as in Song
+
+static int failed = 0;
+
+static void check(bool ok, const char* what) {
+	printf("%-44s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok) failed++;
+}
+
+static void erase() {
+	for (int i = 0; i < 1024; i++) EEPROM.write(i, 0xFF);
+	memset(eeprom_cell_writes, 0, sizeof(eeprom_cell_writes));
+	eeprom_writes = 0;
+}
+
+// run the state's loop() once a millisecond from ms to until.
+
+static void run(PlayerState& state, unsigned long& ms, unsigned long until) {
+	for (; ms < until; ms++) state.loop(ms, false);
+}
+
+int main() {
+	setvbuf(stdout, 0, _IONBF, 0);
+
+	// a session: the volume dragged through 50 steps over 5 s, two track
+	// changes and a seek, then 30 s of playing. each of those was an eeprom
+	// write of its own before the journal.
+
+	erase();
+	{
+		PlayerState state;
+		unsigned long ms = 0;
+
+		state.begin(0, 62, 0, 0, states);
+		unsigned long writes = eeprom_writes, commits = state.getCommits();
+
+		for (int i = 0; i < 50; i++) {
+			state.setVolume(100 - i);
+			run(state, ms, ms + 100);
+		}
+		state.setTrack(1);
+		run(state, ms, ms + 1000);
+		state.setTrack(2);
+		run(state, ms, ms + 500);
+		state.setOffset(40000);
+		run(state, ms, ms + 30000);
+
+		printf("session: %lu eeprom writes in %lu commit(s), for 53 changes\n",
+			eeprom_writes - writes, state.getCommits() - commits);
+	}
+
+	// wear: every cell of the journal should take its turn.
+
+	erase();
+	{
+		PlayerState state;
+		unsigned long most = 0;
+
+		state.begin(0, 62, 0, 0, states);
+		for (int i = 0; i < 1000; i++) {
+			state.setVolume(i % 200);
+			state.commit();
+		}
+		for (int i = 0; i < 1024; i++) {
+			if (eeprom_cell_writes[i] > most) most = eeprom_cell_writes[i];
+		}
+		printf("wear: %lu eeprom writes in 1001 commits, at most %lu to a cell\n",
+			eeprom_writes, most);
+	}
+
+	// a power loss partway through a commit: the record before it stands.
+
+	erase();
+	{
+		PlayerState state;
+		unsigned long ms = 0;
+
+		state.begin(0, 62, 0, 0, states);
+		state.setVolume(100);
+		state.commit();
+		state.setVolume(99);
+		state.loop(ms++, true);          // starts the commit
+		state.loop(ms++, true);
+		state.loop(ms++, true);
+
+		PlayerState after;
+		check(after.begin(0, 62, 0, 0, states) && after.getVolume() == 100,
+			"a torn record is skipped");
+	}
+
+	// a record from before volumes were kept as a percent, with the decoder's
+	// level in it: it's read back as the percent that level stands for.
+
+	erase();
+	{
+		PlayerState state;
+
+		state.begin(0, 62, 0, 0, states);
+		state.setVolume(175);
+		state.commit();
+
+		PlayerState after;
+		check(after.begin(0, 62, 0, 0, states) && after.getVolume() == Fader::toPercent(175),
+			"an old record's level becomes a percent");
+	}
+
+	// file names from an older version, where the journal now is: they
+	// mustn't pass as a record, and the legacy cells are carried over.
+
+	erase();
+	{
+		PlayerState state;
+
+		srand(11);
+		for (int i = journal_start; i < journal_start + journal_slots * (int) sizeof(player_record); i++) {
+			EEPROM.write(i, rand() % 256);
+		}
+		EEPROM.write(0, legacy_init_id);
+		EEPROM.write(legacy_volume, 120);
+		EEPROM.write(legacy_track, 4);
+		EEPROM.write(legacy_state, 1);
+		EEPROM.write(legacy_position, 30);
+
+		check(state.begin(0, 62, 0, 0, states) && state.getVolume() == Fader::toPercent(120) &&
+			state.getTrack() == 4 && state.getState() == 1 && state.getOffset() == 0,
+			"old bytes aren't taken for a record");
+
+		// and out of range legacy cells fall back to the defaults.
+
+		erase();
+		EEPROM.write(0, legacy_init_id);
+		EEPROM.write(legacy_state, 7);
+		EEPROM.write(legacy_position, 250);
+		PlayerState legacy;
+		check(legacy.begin(0, 62, 0, 0, states) && legacy.getVolume() == 62 &&
+			legacy.getState() == 0 && legacy.getOffset() == 0,
+			"out of range legacy cells are left out");
+	}
+
+#if max_players > 1
+	// a second player: its journal comes after the first's, and only the
+	// first carries over the legacy cells.
+
+	erase();
+	{
+		PlayerState first, second;
+
+		EEPROM.write(0, legacy_init_id);
+		EEPROM.write(legacy_volume, 120);
+		check(first.begin(0, 62, 0, 0, states) && !second.begin(1, 62, 0, 0, states) &&
+			second.getVolume() == 62, "legacy cells go to the first journal only");
+		first.setVolume(10);
+		first.commit();
+		second.setVolume(20);
+		second.commit();
+
+		PlayerState first_after, second_after;
+		check(first_after.begin(0, 62, 0, 0, states) && first_after.getVolume() == 10 &&
+			second_after.begin(1, 62, 0, 0, states) && second_after.getVolume() == 20,
+			"each journal keeps its own record");
+	}
+#endif
+	return failed ? 1 : 0;
+}
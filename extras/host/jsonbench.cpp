@@ -0,0 +1,140 @@
+// the cost of building a message with JsonWriter, next to the builder
+// JsonHandler had before it (legacy/OldJsonBuilder).
+//
+//   jsonbench [-check]
+//
+// builds each message many times with both, and prints how long one took
+// on this machine, and whether they came out the same. it exits 1 if one of
+// the plain messages (nothing to escape, numbers under 10000) differs. on
+// the AVR the gap is wider than here: each old pair rescanned the whole
+// message with strlen().
+//
+// with -check it prints what JsonWriter makes of the awkward cases instead
+// (json.expected lists what it should).
+
+#include <JsonWriter.h>
+#include <OldJsonBuilder.h>
+
+#include <chrono>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+static std::string out;
+
+static void sink(void*, const char* buff, unsigned char len) {
+	out.append(buff, len);
+}
+
+struct Message {
+	const char* name;
+	const char* values[4];     // title, artist, album, state
+	int number, position;
+	bool plain;
+};
+
+static const Message messages[] = {
+	{ "info", { "Song Title", "Artist", "Album", "PLAYING" }, 12, 34, true },
+	{ "info_long", { "A Title That Goes On For Quite A While, As Some Do",
+		"An Artist With A Long Name", "The Album, Remastered And Expanded",
+		"PAUSED" }, 255, 99, true },
+	{ "info_quote", { "Song \"Twenty\" Three", "Artist", "Album", "PLAYING" }, 23, 0, false },
+};
+
+// the same pairs Song::sendSongInfo() sends.
+
+static void build_old(OldJsonBuilder& b, const Message& m) {
+	b.addKeyValuePair("title", m.values[0], true);
+	b.addKeyValuePair("artist", m.values[1]);
+	b.addKeyValuePair("album", m.values[2]);
+	b.addKeyValuePair("songNumber", m.number);
+	b.addKeyValuePair("position", m.position);
+	b.addKeyValuePair("state", m.values[3]);
+	out = b.getResponse();
+}
+
+static void build_new(JsonWriter& w, const Message& m) {
+	out.clear();
+	w.beginObject();
+	w.add("title", m.values[0]);
+	w.add("artist", m.values[1]);
+	w.add("album", m.values[2]);
+	w.add("songNumber", m.number, true);
+	w.add("position", m.position, true);
+	w.add("state", m.values[3]);
+	w.endAll();
+	w.flush();
+}
+
+template <class F> static double ns_per(F f) {
+	const int runs = 200000;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int i = 0; i < runs; i++) f();
+	std::chrono::duration<double, std::nano> took = std::chrono::steady_clock::now() - start;
+	return took.count() / runs;
+}
+
+// escaping, utf-8 (whole and cut short), numbers past 32 bits, and nesting
+// past json_max_depth.
+
+static void check() {
+	JsonWriter w(sink, NULL);
+
+	w.beginObject();
+	w.add("quote", "say \"hi\"\\");
+	w.add("control", "tab\there");
+	w.add("utf8", "Caf\xc3\xa9 \xe2\x99\xab");
+	w.add("cut", "Caf\xc3");
+	w.add("cut3", "note \xe2\x99");
+	w.add("big", 2147483647L);
+	w.add("small", -2147483647L - 1);
+	w.beginArray("deep");
+	for (int i = 0; i < 10; i++) w.beginArray(NULL);
+	w.add(NULL, "lost");
+	for (int i = 0; i < 10; i++) w.end();
+	w.add(NULL, "kept");
+	w.end();
+	w.add("after", 1);
+	w.endAll();
+	w.flush();
+	printf("%s\n", out.c_str());
+
+	// the longest number there is, whatever size a long is here.
+	char expected[32];
+	out.clear();
+	w.add(NULL, LONG_MIN);
+	w.endAll();
+	w.flush();
+	snprintf(expected, sizeof(expected), "{%ld}", LONG_MIN);
+	w.flush();
+	printf("LONG_MIN: %s\n", out == expected ? "same as printf" : out.c_str());
+}
+
+int main(int argc, char** argv) {
+	if (argc > 1 && !strcmp(argv[1], "-check")) {
+		check();
+		return 0;
+	}
+
+	OldJsonBuilder old_builder;
+	JsonWriter writer(sink, NULL);
+	int failed = 0;
+
+	printf("%-12s %6s %7s %7s %s\n", "message", "bytes", "old_ns", "new_ns", "output");
+	for (unsigned i = 0; i < sizeof(messages) / sizeof(messages[0]); i++) {
+		const Message& m = messages[i];
+
+		build_old(old_builder, m);
+		std::string old_out = out;
+		build_new(writer, m);
+		bool same = (out == old_out);
+		if (m.plain && !same) failed++;
+
+		double old_ns = ns_per([&] { build_old(old_builder, m); });
+		double new_ns = ns_per([&] { build_new(writer, m); });
+		printf("%-12s %6u %7.0f %7.0f %s\n", m.name, (unsigned) out.size(),
+			old_ns, new_ns, same ? "same" : "differs");
+	}
+	return failed ? 1 : 0;
+}
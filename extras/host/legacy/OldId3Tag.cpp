@@ -0,0 +1,289 @@
+// Id3Tag's scanner as it was before it walked the frames: it slid a window
+// over the tag, 400 bytes at a time. kept so that bench can compare the two.
+
+#include <SD.h>
+#include <OldId3Tag.h>
+
+#define FILE_NAMES_START 32 //leave some room for persisting play info (vol, track, etc.)
+#define max_name_len  13
+#define max_num_songs 40
+
+//allow file scanning to end early if all tags found
+#define MAX_NUM_TAGS 3
+
+#define BUFF_SIZE 400
+
+extern char fn[max_name_len];
+
+//enum tagType { ID3v2, ID3v1, None }
+
+OldId3Tag::OldId3Tag(){
+	clearBuffers();
+	time[0] = '\0';
+	audio_start = 0;
+}
+
+char* OldId3Tag::getTitle(){
+	return title;
+}
+
+char* OldId3Tag::getArtist(){
+	return artist;
+}
+
+char* OldId3Tag::getAlbum(){
+	return album;
+}
+
+char* OldId3Tag::getTime(){
+	return time;
+}
+
+uint32_t OldId3Tag::getAudioStart(){
+	return audio_start;
+}
+
+// fill in a tag that was scanned earlier (and remembered in the library
+// index), instead of scanning the file again.
+
+void OldId3Tag::load(const char* _title, const char* _artist, const char* _album, uint32_t _audio_start){
+	strncpy(title, _title, max_title_len);
+	title[max_title_len] = '\0';
+	strncpy(artist, _artist, max_artist_len);
+	artist[max_artist_len] = '\0';
+	strncpy(album, _album, max_album_len);
+	album[max_album_len] = '\0';
+	audio_start = _audio_start;
+}
+
+// this utility function reads id3v1 and id3v2 tags, if any are present, from
+// mp3 audio files. if no tags are found, just use the title of the file. :-|
+
+void OldId3Tag::getId3Tag(SdFile* sd_file, char* value, unsigned char pb[], unsigned char c, int j){
+	uint32_t origPos = sd_file->curPosition();
+	sd_file->seekCur(-j);
+	//Serial.println("getId3Tag");
+	//Serial.println(sd_file->curPosition());
+	// found an id3v2.3 frame! the length is in the next 4 bytes.
+        
+    sd_file->read(pb, 4);
+
+    // only the last of these bytes is likely needed, as it can represent
+    // titles up to 255 characters. but to combine these 4 bytes together
+    // into the single value, we first have to shift each one over to get
+    // it into its correct 'digits' position. 
+
+    unsigned long tl = ((unsigned long) pb[0] << (8 * 3)) +
+                        ((unsigned long) pb[1] << (8 * 2)) +
+                        ((unsigned long) pb[2] << (8 * 1)) + pb[3];
+    tl--;
+    
+    // skip 2 bytes (header flags that we don't use), then read in 1 byte of text encoding. 
+
+    sd_file->read(pb, 2);
+    sd_file->read(&c, 1);
+        
+    // if c=1, the title is in unicode, which uses 2 bytes per character.
+    // skip the next 2 bytes (the byte order mark) and decrement tl by 2.
+        
+    if (c) {
+        sd_file->read(pb, 2);
+        tl -= 2;
+    }
+    // remember that titles are limited to only max_title_len bytes long.
+    
+    if (tl > max_title_len) tl = max_title_len;
+        
+    // read in tl bytes of the title itself. add an 'end-of-string' byte.
+
+    sd_file->read(value, tl);
+	value[tl] = '\0';
+
+	if (value[1] == '\0'){
+		// at odd indices seem to have null terminators so let's get rid of them
+		for(int i = 0; i < tl; i++){
+			if (i % 2 == 1) continue;
+			value[i/2] = value[i];
+			//Serial.print(title[i]);
+		}
+
+		//add a null terminator at the new end of the title
+		value[tl/2] = '\0';
+	}
+
+	//Serial.print("value: ");
+	//Serial.println(value);
+	//Serial.println("END getId3Tag");
+	sd_file->seekSet(origPos);
+}
+
+void OldId3Tag::clearBuffers(){
+	title[0] = '\0';
+	artist[0] = '\0';
+	album[0] = '\0';
+}
+
+void OldId3Tag::scan(SdFile* sd_file){
+	//Serial.println("OldId3Tag::scan()");
+	clearBuffers();
+	audio_start = 0;
+	int numTagsFound = 0;
+
+  unsigned char id3[3];       // pointer to the first 3 characters to read in
+
+  // visit http://www.id3.org/id3v2.3.0 to learn all(!) about the id3v2 spec.
+  // move the file pointer to the beginning, and read the first 3 characters.
+
+  sd_file->seekSet(0);
+  sd_file->read(id3, 3);
+  
+  // if these first 3 characters are 'ID3', then we have an id3v2 tag. if so,
+  // a 'TIT2' (for ver2.3) or 'TT2' (for ver2.2) frame holds the song title.
+  if (id3[0] == 'I' && id3[1] == 'D' && id3[2] == '3') {
+	  //Serial.println("ID3");
+    unsigned char pb[4];       // pointer to the last 4 characters we read in
+    unsigned char c;           // the next 1 character in the file to be read
+    
+    // our first task is to find the length of the (whole) id3v2 tag. knowing
+    // this means that we can look for 'TIT2' or 'TT2' frames only within the
+    // tag's length, rather than the entire file (which can take a while).
+
+    // skip 3 bytes (that we don't use), then read in the last 4 bytes of the
+    // header, which contain the tag's length.
+
+    sd_file->read(pb, 3);
+    unsigned char flags = pb[2];
+    sd_file->read(pb, 4);
+    
+    // to combine these 4 bytes together into the single value, we first have
+    // to shift each one over to get it into its correct 'digits' position. a
+    // quirk of the spec is that bit 7 (the msb) of each byte is set to 0.
+    
+    unsigned long v2l = ((unsigned long) pb[0] << (7 * 3)) +
+                        ((unsigned long) pb[1] << (7 * 2)) +
+                        ((unsigned long) pb[2] << (7 * 1)) + pb[3];
+
+    // the audio starts right after the 10 byte header, the tag itself, and
+    // (in id3v2.4, if the footer flag is set) a 10 byte footer.
+
+    audio_start = 10 + v2l + ((flags & 0x10) ? 10 : 0);
+
+	v2l /= 8; 
+    // we just moved the file pointer 10 bytes into the file, so we reset it.
+    
+    sd_file->seekSet(0);
+
+	//Serial.print("id3 header length: ");
+	//Serial.println(v2l);
+	
+	char buff[BUFF_SIZE+1];
+
+    for(int i = 0; i < v2l; i+=BUFF_SIZE){
+		sd_file->read(buff, BUFF_SIZE);
+		buff[BUFF_SIZE] = 0;
+		for(int j = 0; j < BUFF_SIZE; j++){
+      // read in bytes of the file, one by one, so we can check for the tags.
+      
+      //sd_file->read(&c, 1);
+	  c = buff[j];
+      // keep shifting over previously-read bytes as we read in each new one.
+      // that way we keep testing if we've found a 'TIT2' or 'TT2' frame yet.
+      
+      pb[0] = pb[1];
+      pb[1] = pb[2];
+      pb[2] = pb[3];
+      pb[3] = c;
+
+	  //Serial.print(c);
+
+      if (pb[0] == 'T' && pb[1] == 'I' && pb[2] == 'T' && pb[3] == '2') {
+		  numTagsFound++;
+		  //Serial.println("title");
+		  getId3Tag(sd_file, title, pb, c, BUFF_SIZE-j-1);
+      }
+	  else if (pb[0] == 'T' && pb[1] == 'P' && pb[2] == 'E' && pb[3] == '1') {
+		  numTagsFound++;
+		  //Serial.println("artist");
+		  getId3Tag(sd_file, artist, pb, c, BUFF_SIZE-j-1);
+	  }
+	  else if (pb[0] == 'T' && pb[1] == 'A' && pb[2] == 'L' && pb[3] == 'B') {
+		  numTagsFound++;
+		  //Serial.println("album");
+		  getId3Tag(sd_file, album, pb, c, BUFF_SIZE-j-1);
+		  
+	  }
+	  /*else if (pb[0] == 'T' && pb[1] == 'I' && pb[2] == 'M' && pb[3] == 'E') {
+		  Serial.println("time");
+		  getId3Tag(time, pb, c);
+	  }*/
+      else if (pb[1] == 'T' && pb[2] == 'T' && pb[3] == '2') {
+		  numTagsFound++;
+		  //Serial.println("TT2");
+        // found an id3v2.2 frame! the title's length is in the next 3 bytes,
+        // but we read in 4 then ignore the last, which is the text encoding.
+        
+        sd_file->read(pb, 4);
+        
+        // shift each byte over to get it into its correct 'digits' position. 
+        
+        unsigned long tl = ((unsigned long) pb[0] << (8 * 2)) +
+                           ((unsigned long) pb[1] << (8 * 1)) + pb[2];
+        tl--;
+        
+        // remember that titles are limited to only max_title_len bytes long.
+
+        if (tl > max_title_len) tl = max_title_len;
+
+        // there's no text encoding, so read in tl bytes of the title itself.
+        
+        sd_file->read(title, tl);
+        title[tl] = '\0';
+        break;
+      }
+      else
+      if (sd_file->curPosition() == v2l) {
+		  Serial.println("EOT");
+        // we reached the end of the id3v2 tag. use the file name as a title.
+
+        strncpy(title, fn, max_name_len);
+        break;
+      }
+    }
+	}
+  }
+  else {
+    // the file doesn't have an id3v2 tag so search for an id3v1 tag instead.
+    // an id3v1 tag begins with the 3 characters 'TAG'. if these are present,
+    // then they are located exactly 128 bits from the end of the file.
+    
+    sd_file->seekSet(sd_file->fileSize() - 128);
+    sd_file->read(id3, 3);
+    
+    if (id3[0] == 'T' && id3[1] == 'A' && id3[2] == 'G') {
+		Serial.println("TAG");
+      // found it! now read in the full title, which is always 30 bytes long.
+      
+      sd_file->read(title, 30);
+      
+      // strip spaces and non-printable characters from the end of the title.
+      // you may have to expand this range to incorporate unicode characters.
+      
+      for (char i = 30 - 1; i >= 0; i--) {
+        if (title[i] <= ' ' || title[i] > 126) {
+          title[i] = '\0';
+        }
+        else {
+          break;
+        }
+      }
+    }
+    else {
+      // we reached the end of the id3v1 tag. use the file name as a title.
+      
+      strncpy(title, fn, max_name_len);
+    }
+  }
+  
+  sd_file->seekSet(0);
+  //Serial.println("exit id3tag");
+}
\ No newline at end of file
@@ -0,0 +1,48 @@
+// see OldId3Tag.cpp.
+
+#ifndef OLDID3TAG_H
+#define OLDID3TAG_H
+
+// id3v2 tags have variable-length song titles. that length is indicated in 4
+// bytes within the tag. id3v1 tags also have variable-length song titles, up
+// to 30 bytes maximum, but the length is not indicated within the tag. using
+// 60 bytes here is a compromise between holding most titles and saving sram.
+
+#define max_title_len 60
+#define max_artist_len 30
+#define max_album_len 40
+#define max_year_len 4
+#define max_time_len 10
+
+class OldId3Tag
+{
+  public:
+	OldId3Tag();
+	void scan(SdFile* sd_file);
+	void load(const char* title, const char* artist, const char* album, uint32_t audio_start);
+
+	char* getTitle();
+	char* getArtist();
+	char* getAlbum();
+	char* getTime();
+	char* getTag(const char* tag);
+	uint32_t getAudioStart();
+  private:
+	void getId3Tag(SdFile* sd_file, char* value, unsigned char pb[], unsigned char c, int j);
+	void clearBuffers();
+
+	// each tag holds its own strings, so that the next song's tag can be read
+	// while the current one is still playing. each needs 1 extra char to hold
+	// the '\0' that indicates the end of a character string.
+
+	char title[max_title_len + 1];
+	char artist[max_artist_len + 1];
+	char album[max_album_len + 1];
+	char time[max_time_len + 1];
+
+	// the offset of the first byte after the id3v2 tag (0 if there is none).
+
+	uint32_t audio_start;
+};
+
+#endif
\ No newline at end of file
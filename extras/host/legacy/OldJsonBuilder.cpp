@@ -0,0 +1,46 @@
+// JsonHandler's message builder as it was before JsonWriter (user-008), for
+// jsonbench to compare against. only the class name changed, and the message
+// is returned instead of printed.
+
+#include <OldJsonBuilder.h>
+#include <stdio.h>
+#include <string.h>
+
+char response[200];
+
+void OldJsonBuilder::addKeyValuePair(const char* key, const char* val, bool firstPair){
+  char* appendChars = ",\"";
+  int offset = 1;
+  if (firstPair){
+    strcpy(response, "{}");
+    offset = 0;
+    appendChars = "\"";
+  }
+
+  int len = strlen(response);
+  int lenKey = strlen(key);
+  int lenVal = strlen(val);
+  strcpy(response+len-1, appendChars);
+  strcpy(response+len+offset, key);
+  strcpy(response+len+offset+lenKey, "\":\"");
+  strcpy(response+len+offset+lenKey+3, val);
+  strcpy(response+len+offset+lenKey+3+lenVal, "\"}");
+  response[strlen(response)+1] = '\0';
+}
+
+void OldJsonBuilder::addKeyValuePair(const char* key, const char* val){
+  addKeyValuePair(key, val, false); 
+}
+
+// snprintf() stands in for itoa(), which the host doesn't have. it cuts a
+// number off at the buffer's 4 digits, where itoa() wrote past its end.
+
+void OldJsonBuilder::addKeyValuePair(const char* key, int val){
+  char buff[5];
+  snprintf(buff, sizeof(buff), "%d", val);
+  addKeyValuePair(key, buff, false); 
+}
+
+const char* OldJsonBuilder::getResponse(){
+  return response;
+}
@@ -0,0 +1,15 @@
+// see OldJsonBuilder.cpp.
+
+#ifndef OLDJSONBUILDER_H
+#define OLDJSONBUILDER_H
+
+class OldJsonBuilder
+{
+  public:
+	void addKeyValuePair(const char* key, const char* val, bool firstPair);
+	void addKeyValuePair(const char* key, const char* val);
+	void addKeyValuePair(const char* key, int val);
+	const char* getResponse();
+};
+
+#endif
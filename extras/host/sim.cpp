@@ -0,0 +1,170 @@
+// runs a player on the host models (see stubs/host.h): boots it, feeds it
+// uart commands at given times, plays for a while, and prints what it cost.
+//
+//   sim [-players n] [ms [sketch_us [info_ms]]] [[at:]command ...]
+//
+// plays for ms of simulated time (5000 by default), from the card in
+// $SDROOT. sketch_us is the time the rest of the sketch's loop() takes, 50 us
+// by default. if info_ms is given, the sketch sends the song info that often,
+// as it would for a client that keeps asking. each command is a uart frame
+// without its '!', e.g. "VOL,40" or "2000:NEXT" (see command() for the ones
+// it knows). they arrive in order, each once 'at' ms have passed since boot
+// (straight away if it's left out). it exits 1 if a decoder ran dry
+// mid-song.
+//
+// with -players, n players share the card: the first on the mp3 library's
+// decoder, the others on decoders of their own (see stubs/host.h), and each
+// player after the first moves to the song with its number once the library
+// is indexed. the commands go to the first. what was played and the
+// underruns are added up over all of them. n can be up to max_players,
+// which is 1 for sim, and 4 for sim_players.
+
+#include <SD.h>
+#include <EEPROM.h>
+#include <mp3.h>
+#include <mp3conf.h>
+#include <Song.h>
+#include <host.h>
+
+#include <ctype.h>
+#include <vector>
+
+// what a sketch would do with the commands; Song only passes them on.
+
+static Song* player;
+
+// the other players' decoders, by number.
+
+static void play_data(void* context, unsigned char* data, unsigned char len) {
+	decoder_play((int) (long) context, data, len);
+}
+
+static void set_volume(void* context, unsigned char volume) {
+}
+
+static void command(char* cmd, char* data) {
+	if (!strcmp(cmd, "PLAY")) player->play();
+	else if (!strcmp(cmd, "PAUSE")) player->pause();
+	else if (!strcmp(cmd, "NEXT")) player->nextFile();
+	else if (!strcmp(cmd, "PREV")) player->prevFile();
+	else if (!strcmp(cmd, "NEXTFOLDER")) player->nextFolder();
+	else if (!strcmp(cmd, "PREVFOLDER")) player->prevFolder();
+	else if (!strcmp(cmd, "FOLDERPLAY")) player->setFolderPlay(atoi(data));
+	else if (!strcmp(cmd, "SONG")) player->setSong(atoi(data));
+	else if (!strcmp(cmd, "SEEK")) player->seek(atoi(data));
+	else if (!strcmp(cmd, "VOL")) player->setVolume(atoi(data));
+	else if (!strcmp(cmd, "STATE")) player->sendPlayerState();
+	else if (!strcmp(cmd, "INFO")) player->sendSongInfo();
+	else if (!strcmp(cmd, "STATS")) player->sendStats();
+	else if (!strcmp(cmd, "LIBRARY")) player->sendLibrary(data);
+}
+
+struct Command {
+	unsigned long at;              // ms after boot
+	std::string frame;
+};
+
+int main(int argc, char** argv) {
+	unsigned long numbers[3] = { 5000, 50, 0 };
+	std::vector<Command> commands;
+	int n = 0, players = 1, first = 1;
+
+	if (argc > 2 && !strcmp(argv[1], "-players")) {
+		players = atoi(argv[2]);
+		first = 3;
+	}
+	if (players < 1 || players > max_players || players > host_decoders) {
+		fprintf(stderr, "sim: this build has room for %d player(s)\n", max_players);
+		return 2;
+	}
+	for (int i = first; i < argc; i++) {
+		std::string arg = argv[i];
+		size_t colon = arg.find(':');
+
+		if (n < 3 && commands.empty() && isdigit(arg[0]) && colon == std::string::npos) {
+			numbers[n++] = atol(argv[i]);
+			continue;
+		}
+		Command c = { 0, arg };
+		if (colon != std::string::npos) {
+			c.at = atol(arg.c_str());
+			c.frame.erase(0, colon + 1);
+		}
+		commands.push_back(c);
+	}
+	unsigned long ms = numbers[0], sketch_us = numbers[1], info_ms = numbers[2];
+
+	setvbuf(stdout, 0, _IONBF, 0);
+	JsonHandler handler;
+	Song song;
+	std::vector<Song*> others;
+
+	player = &song;
+	handler.onCommand(command);
+	handler.setup();
+	song.setup(&handler);
+	for (int i = 1; i < players; i++) {
+		others.push_back(new Song(decoder_pin + i, play_data, set_volume, (void*) (long) i));
+		others.back()->setup(&handler);
+	}
+	printf("boot: %.1f ms, %lu sd reads (%lu bytes, %lu seeks), %lu eeprom writes\n",
+		sim_us / 1000.0, sd_reads, sd_bytes, sd_seeks, eeprom_writes);
+
+	unsigned long long start = sim_us;
+	unsigned long reads = sd_reads, opens = sd_opens, writes = eeprom_writes;
+	unsigned long bytes = uart_bytes, waited = uart_wait_us;
+	unsigned long long info_at = start;
+	unsigned long longest = 0;
+	size_t next = 0;
+	bool moved = others.empty();
+
+	while (sim_us - start < ms * 1000ULL) {
+		while (next < commands.size() && (sim_us - start) / 1000 >= commands[next].at) {
+			uart_in += commands[next].frame + "!";
+			next++;
+		}
+		if (!moved && !song.isIndexing()) {
+			for (size_t i = 0; i < others.size(); i++) others[i]->setSong(i + 1);
+			moved = true;
+		}
+
+		unsigned long long loop_start = sim_us;
+		if (!song.isPlaying()) decoder_idle();
+		for (size_t i = 0; i < others.size(); i++) {
+			if (!others[i]->isPlaying()) decoder_idle(i + 1);
+		}
+		handler.readCommand();
+		song.loop();
+		if (sim_us - loop_start > longest) longest = sim_us - loop_start;
+
+		sim_us += sketch_us;
+		if (info_ms && sim_us >= info_at + info_ms * 1000ULL) {
+			info_at += info_ms * 1000ULL;
+			song.sendSongInfo();
+			handler.respond();
+		}
+	}
+
+	unsigned long underruns = song.getUnderruns();
+	for (size_t i = 0; i < others.size(); i++) underruns += others[i]->getUnderruns();
+	printf("played: %lu bytes in %.1f ms, starved %lu us, %lu underruns\n",
+		dec_bytes, (sim_us - start) / 1000.0, dec_starved_us, underruns);
+	if (players > 1) {
+		printf("players: %d, %.1f KB/s to the decoders together\n",
+			players, dec_bytes / 1.024 / ((sim_us - start) / 1000.0));
+		for (size_t i = 0; i < others.size(); i++) {
+			printf("player %d: %s, %d%%, %lu underruns\n", (int) i + 1, others[i]->getTitle(),
+				others[i]->percentPlayed(), others[i]->getUnderruns());
+		}
+	}
+	printf("while playing: %lu sd reads, %lu opens, %lu eeprom writes, longest loop() %lu us\n",
+		sd_reads - reads, sd_opens - opens, eeprom_writes - writes, longest);
+	printf("uart: %lu bytes, write() waited %lu us\n",
+		uart_bytes - bytes, uart_wait_us - waited);
+	printf("responses: %lu bytes queued, %lu sent, %lu dropped, %u waiting\n",
+		handler.getTxQueued(), handler.getTxSent(), handler.getTxDropped(),
+		handler.getTxLevel());
+	printf("now: %s, %d%%, volume %d, folder %u, %s\n", song.getTitle(), song.percentPlayed(),
+		song.getVolume(), song.getFolder(), song.isPlaying() ? "playing" : "paused");
+	return dec_starved_us ? 1 : 0;
+}
@@ -0,0 +1,65 @@
+// host stand-in for the teensy's arduino core. time is simulated (see
+// host.h): it only moves when the library or the harness spends it.
+
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <Stream.h>
+
+#define HIGH           1
+#define LOW            0
+#define INPUT          0
+#define OUTPUT         1
+#define SS_PIN         0
+
+#define PROGMEM
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+#define pgm_read_word(p) (*(const uint16_t*)(p))
+
+typedef uint8_t byte;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+int digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t val);
+void pinMode(uint8_t pin, uint8_t mode);
+
+char* itoa(int val, char* buf, int radix);
+char* ltoa(long val, char* buf, int radix);
+char* ultoa(unsigned long val, char* buf, int radix);
+
+// Serial is the usb debug port, and only echoed (with ECHO set); any other
+// instance is the uart to the host controller (see host.h).
+
+class HardwareSerial : public Stream
+{
+  public:
+	void begin(long baud);
+	int available();
+	int read();
+	void print(const char* s);
+	void print(char c);
+	void print(int val);
+	void print(unsigned int val);
+	void print(long val);
+	void print(unsigned long val);
+	void println(const char* s);
+	void println(int val);
+	void println(unsigned int val);
+	void println(long val);
+	void println(unsigned long val);
+	void println();
+	void write(uint8_t c);
+	void write(const uint8_t* buf, size_t len);
+};
+
+extern HardwareSerial Serial;
+
+#endif
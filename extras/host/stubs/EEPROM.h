@@ -0,0 +1,17 @@
+// host stand-in for the eeprom library: 1 KB, 3.3 ms per write.
+
+#ifndef EEPROM_h
+#define EEPROM_h
+
+#include <Arduino.h>
+
+class EEPROMClass
+{
+  public:
+	uint8_t read(int addr);
+	void write(int addr, uint8_t val);
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
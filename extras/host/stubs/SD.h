@@ -0,0 +1,92 @@
+// host stand-in for the sdfat library the teensy's SD.h wraps, with only
+// the calls the library makes. files come from a host directory (see
+// host.h); the names are shown to the library as 8.3.
+
+#ifndef SD_h
+#define SD_h
+
+#include <Arduino.h>
+
+#define O_READ 0x01
+#define O_RDONLY O_READ
+#define O_WRITE 0x02
+#define O_RDWR (O_READ | O_WRITE)
+#define O_CREAT 0x10
+#define O_TRUNC 0x40
+#define FILE_READ O_READ
+#define FILE_WRITE (O_READ | O_WRITE | O_CREAT)
+
+#define SPI_FULL_SPEED 0
+#define SPI_HALF_SPEED 1
+
+#define DIR_NAME_FREE 0x00
+#define DIR_NAME_DELETED 0xE5
+#define DIR_ATT_DIRECTORY 0x10
+#define DIR_ATT_VOLUME_ID 0x08
+#define DIR_ATT_FILE_TYPE_MASK (DIR_ATT_VOLUME_ID | DIR_ATT_DIRECTORY)
+
+// a fat directory entry, as readDir() gives it.
+
+typedef struct directoryEntry {
+  uint8_t name[11];
+  uint8_t attributes;
+  uint8_t reservedNT;
+  uint8_t creationTimeTenths;
+  uint16_t creationTime;
+  uint16_t creationDate;
+  uint16_t lastAccessDate;
+  uint16_t firstClusterHigh;
+  uint16_t lastWriteTime;
+  uint16_t lastWriteDate;
+  uint16_t firstClusterLow;
+  uint32_t fileSize;
+} dir_t;
+
+static inline uint8_t DIR_IS_FILE(const dir_t* dir) { return (dir->attributes & DIR_ATT_FILE_TYPE_MASK) == 0; }
+static inline uint8_t DIR_IS_SUBDIR(const dir_t* dir) { return (dir->attributes & DIR_ATT_FILE_TYPE_MASK) == DIR_ATT_DIRECTORY; }
+
+class Sd2Card
+{
+  public:
+	uint8_t init(uint8_t sckRateID, uint8_t chipSelectPin);
+	uint8_t readStart(uint32_t block);
+	uint8_t readData(uint8_t* dst);
+	uint8_t readStop();
+};
+
+class SdVolume
+{
+  public:
+	uint8_t init(Sd2Card& dev);
+	uint8_t init(Sd2Card* dev);
+};
+
+class SdFile
+{
+  public:
+	SdFile();
+	uint8_t open(SdFile* dirFile, const char* fileName, uint8_t oflag);
+	uint8_t open(SdFile* dirFile, uint16_t index, uint8_t oflag);
+	uint8_t openRoot(SdVolume* vol);
+	uint8_t close();
+	int16_t read(void* buf, uint16_t nbyte);
+	int16_t read();
+	size_t write(const void* buf, uint16_t nbyte);
+	int8_t readDir(dir_t* dir);
+	void rewind();
+	uint8_t seekSet(uint32_t pos);
+	uint8_t seekCur(int32_t pos);
+	uint8_t seekEnd();
+	uint32_t curPosition() const;
+	uint32_t fileSize() const;
+	uint32_t firstCluster() const;
+	uint8_t isOpen() const;
+	uint8_t isDir() const;
+	uint8_t sync();
+	uint8_t truncate(uint32_t size);
+	uint8_t contiguousRange(uint32_t* bgnBlock, uint32_t* endBlock);
+  private:
+	void* impl;                    // the host file, see host.cpp
+};
+
+#endif
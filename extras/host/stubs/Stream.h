@@ -0,0 +1,13 @@
+// host stand-in for the arduino core's Stream, just what JsonHandler uses.
+
+#ifndef Stream_h
+#define Stream_h
+
+class Stream
+{
+  public:
+	virtual int available() = 0;
+	virtual int read() = 0;
+};
+
+#endif
@@ -0,0 +1,527 @@
+// the models behind the host stand-ins; see host.h.
+
+#include <Arduino.h>
+#include <SD.h>
+#include <EEPROM.h>
+#include <mp3.h>
+#include <host.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+unsigned long long sim_us = 0;
+unsigned long sd_reads = 0, sd_bytes = 0, sd_seeks = 0, sd_opens = 0;
+unsigned long eeprom_writes = 0;
+unsigned long eeprom_cell_writes[1024];
+unsigned long dec_bytes = 0, dec_starved_us = 0;
+unsigned long uart_bytes = 0, uart_wait_us = 0;
+std::string uart_in;
+
+static bool echo = getenv("ECHO") != 0;
+
+// $UART_BAUD sets the uart's speed (9600 by default), $SD_LATENCY the time a
+// card read takes before its data (200 us by default), $DECODED names a file
+// that gets every byte sent to the decoder, $READONLY write protects the card
+// and $EEPROM_FILE keeps the eeprom from one run to the next.
+
+static unsigned long uart_byte_us = 10000000UL / (getenv("UART_BAUD") ? atol(getenv("UART_BAUD")) : 9600);
+static unsigned long sd_latency_us = getenv("SD_LATENCY") ? atol(getenv("SD_LATENCY")) : 200;
+static FILE* decoded = getenv("DECODED") ? fopen(getenv("DECODED"), "wb") : 0;
+static bool readonly = getenv("READONLY") != 0;
+static bool fragmented = getenv("FRAGMENTED") != 0;
+
+// time
+
+unsigned long millis() { sim_us += 5; return sim_us / 1000; }
+unsigned long micros() { sim_us += 5; return sim_us; }
+void delay(unsigned long ms) { sim_us += ms * 1000; }
+void digitalWrite(uint8_t, uint8_t) {}
+void pinMode(uint8_t, uint8_t) {}
+
+char* itoa(int v, char* b, int) { sprintf(b, "%d", v); return b; }
+char* ltoa(long v, char* b, int) { sprintf(b, "%ld", v); return b; }
+char* ultoa(unsigned long v, char* b, int) { sprintf(b, "%lu", v); return b; }
+
+// the decoders: the mp3 library's, and host_decoders - 1 more for players
+// of the sketch's own (see host.h). each has a fifo of its own.
+
+#define fifo_size      2048
+#define fifo_chunk     32
+#define byte_rate      16000.0   // bytes/s
+
+struct Decoder {
+	double fifo;                      // bytes waiting
+	unsigned long long drained_to;    // sim_us the fifo was last drained to
+	bool idle;                        // not fed on purpose since it ran dry
+	bool fed;                         // sent a byte yet
+};
+
+static Decoder decoders[host_decoders];
+
+static Decoder& decoder_at(uint8_t pin) {
+	if (pin > decoder_pin && pin < decoder_pin + host_decoders) return decoders[pin - decoder_pin];
+	return decoders[0];
+}
+
+static void drain(Decoder& d) {
+	double want = (sim_us - d.drained_to) / 1e6 * byte_rate;
+
+	d.drained_to = sim_us;
+	if (d.fifo < want) {
+		if (d.fed && !d.idle) dec_starved_us += (unsigned long)((want - d.fifo) / byte_rate * 1e6);
+		d.fifo = 0;
+	}
+	else {
+		d.fifo -= want;
+	}
+}
+
+// the sketch has stopped feeding on purpose (paused, say): the fifo plays out
+// without that counting as starved, until the next byte is sent.
+
+void decoder_idle(int n) {
+	drain(decoders[n]);
+	decoders[n].idle = true;
+}
+
+int digitalRead(uint8_t pin) {
+	Decoder& d = decoder_at(pin);
+
+	sim_us += 2;
+	drain(d);
+	return d.fifo <= fifo_size - fifo_chunk;
+}
+
+// decoder n takes a chunk, once it has room. only the mp3 library's (0) is
+// written to $DECODED.
+
+void decoder_play(int n, const unsigned char* data, int len) {
+	Decoder& d = decoders[n];
+
+	while (!digitalRead(n ? decoder_pin + n : 0)) sim_us += 100;
+	d.fifo += len;
+	d.fed = true;
+	d.idle = false;
+	dec_bytes += len;
+	if (decoded && n == 0) fwrite(data, 1, len, decoded);
+	sim_us += len * 2;
+}
+
+void Mp3Class::begin(int, int, int, int) { sim_us += 10000; }
+
+void Mp3Class::play(const unsigned char* data, int len) {
+	decoder_play(0, data, len);
+}
+
+void Mp3Class::volume(unsigned char) {}
+
+Mp3Class Mp3;
+
+// serial ports. what's put in uart_in arrives on the uart, all at once;
+// nothing arrives on usb serial. the uart has a 40 byte transmit buffer,
+// as the teensy's does, that empties at the baud rate: write() only takes
+// time when it's full, and then waits for a byte to go out.
+
+#define uart_buffer 40
+
+static unsigned long long uart_free_us = 0;     // when the buffer will be empty
+
+void HardwareSerial::begin(long) {}
+int HardwareSerial::available() {
+	return this == &Serial ? 0 : (int) uart_in.size();
+}
+
+int HardwareSerial::read() {
+	if (this == &Serial || uart_in.empty()) return -1;
+	char c = uart_in[0];
+	uart_in.erase(0, 1);
+	return (uint8_t) c;
+}
+
+void HardwareSerial::write(uint8_t c) {
+	if (this != &Serial) {
+		if (uart_free_us < sim_us) uart_free_us = sim_us;
+		if (uart_free_us - sim_us > (uart_buffer - 1) * uart_byte_us) {
+			unsigned long long room = uart_free_us - (uart_buffer - 1) * uart_byte_us;
+			uart_wait_us += room - sim_us;
+			sim_us = room;
+		}
+		uart_free_us += uart_byte_us;
+		uart_bytes++;
+	}
+	if (echo) putchar(c);
+}
+
+void HardwareSerial::write(const uint8_t* buf, size_t len) {
+	for (size_t i = 0; i < len; i++) write(buf[i]);
+}
+
+void HardwareSerial::print(const char* s) { write((const uint8_t*) s, strlen(s)); }
+void HardwareSerial::print(char c) { write(c); }
+void HardwareSerial::print(int v) { print((long) v); }
+void HardwareSerial::print(unsigned int v) { print((unsigned long) v); }
+void HardwareSerial::print(long v) { char b[24]; sprintf(b, "%ld", v); print(b); }
+void HardwareSerial::print(unsigned long v) { char b[24]; sprintf(b, "%lu", v); print(b); }
+void HardwareSerial::println(const char* s) { print(s); println(); }
+void HardwareSerial::println(int v) { print(v); println(); }
+void HardwareSerial::println(unsigned int v) { print(v); println(); }
+void HardwareSerial::println(long v) { print(v); println(); }
+void HardwareSerial::println(unsigned long v) { print(v); println(); }
+void HardwareSerial::println() { print("\n"); }
+
+HardwareSerial Serial;
+
+// eeprom. it starts out blank (0xFF), or as $EEPROM_FILE left it, and goes
+// back there as it's written.
+
+static uint8_t eeprom[1024];
+static FILE* eeprom_file;
+
+static void eeprom_load() {
+	static bool loaded = false;
+
+	if (loaded) return;
+	loaded = true;
+	memset(eeprom, 0xFF, sizeof(eeprom));
+	const char* name = getenv("EEPROM_FILE");
+	if (!name) return;
+	eeprom_file = fopen(name, "r+b");
+	if (eeprom_file) {
+		if (fread(eeprom, 1, sizeof(eeprom), eeprom_file)) {}
+	}
+	else {
+		eeprom_file = fopen(name, "w+b");
+		if (eeprom_file) fwrite(eeprom, 1, sizeof(eeprom), eeprom_file);
+	}
+	if (eeprom_file) fflush(eeprom_file);
+}
+
+uint8_t EEPROMClass::read(int addr) {
+	eeprom_load();
+	return eeprom[addr & 1023];
+}
+
+void EEPROMClass::write(int addr, uint8_t val) {
+	eeprom_load();
+	eeprom[addr & 1023] = val;
+	eeprom_writes++;
+	eeprom_cell_writes[addr & 1023]++;
+	sim_us += 3300;
+	if (eeprom_file) {
+		fseek(eeprom_file, addr & 1023, SEEK_SET);
+		fputc(val, eeprom_file);
+		fflush(eeprom_file);
+	}
+}
+
+EEPROMClass EEPROM;
+
+// sd card, backed by the SDROOT directory. each file is given a first
+// cluster from a hash of its path on the card (so the same card costs the
+// same wherever it's written), and the change date from its mtime, so a
+// file that's rewritten looks changed. on a write protected card, files open
+// as they would on the board, but can't be created, and writes fail.
+//
+// contiguousRange() places a file on made-up card blocks the first time it's
+// asked, so that a multi-block read (readStart()) can find it, unless
+// $FRAGMENTED is set, when no file is contiguous. a multi-block read pays the
+// card's latency once, and then only 2 us/byte for each block. nothing else
+// may use the card until readStop().
+
+struct HostFile {
+	std::string path;
+	bool dir;
+	FILE* f;
+	uint32_t pos, size, cluster;
+	std::vector<std::string> entries;  // a directory's, "." and ".." first
+};
+
+#define H ((HostFile*) impl)
+
+static std::vector<std::pair<uint32_t, std::string> > placed;  // first block, path
+static uint32_t next_block = 1000;
+static uint32_t raw_block;             // next block of the multi-block read...
+static bool raw_open = false;          // ...if there is one
+
+static void card_free() {
+	if (raw_open) {
+		fprintf(stderr, "sd access during a multi-block read\n");
+		abort();
+	}
+}
+
+static void to83(const std::string& n, uint8_t* out) {
+	size_t dot = n.find('.');
+	std::string base = n.substr(0, dot);
+	std::string ext = dot == std::string::npos ? "" : n.substr(dot + 1);
+
+	memset(out, ' ', 11);
+	for (size_t i = 0; i < base.size() && i < 8; i++) out[i] = toupper(base[i]);
+	for (size_t i = 0; i < ext.size() && i < 3; i++) out[8 + i] = toupper(ext[i]);
+}
+
+static std::string root_path;
+
+static uint32_t hash(const std::string& s) {
+	uint32_t h = 5381;
+	size_t i = s.compare(0, root_path.size(), root_path) ? 0 : root_path.size();
+	for (; i < s.size(); i++) h = h * 33 + s[i];
+	return h & 0x0fffffff;
+}
+
+static void list(HostFile* d) {
+	std::vector<std::string> names;
+	DIR* dir = opendir(d->path.c_str());
+	struct dirent* e;
+
+	while (dir && (e = readdir(dir))) {
+		std::string n = e->d_name;
+		if (n != "." && n != "..") names.push_back(n);
+	}
+	if (dir) closedir(dir);
+	std::sort(names.begin(), names.end());
+	d->entries.clear();
+	d->entries.push_back(".");
+	d->entries.push_back("..");
+	d->entries.insert(d->entries.end(), names.begin(), names.end());
+}
+
+uint8_t Sd2Card::init(uint8_t, uint8_t) { return 1; }
+
+uint8_t Sd2Card::readStart(uint32_t block) {
+	card_free();
+	raw_block = block;
+	raw_open = true;
+	sd_reads++;
+	sim_us += sd_latency_us;
+	return 1;
+}
+
+uint8_t Sd2Card::readData(uint8_t* dst) {
+	size_t i = placed.size();
+
+	// files are placed in order, so the block is in the last one that
+	// starts at or before it (or in the gap after that one).
+
+	if (!raw_open) return 0;
+	while (i > 0 && placed[i - 1].first > raw_block) i--;
+	memset(dst, 0, 512);
+	if (i-- > 0) {
+		FILE* f = fopen(placed[i].second.c_str(), "rb");
+		if (f) {
+			fseek(f, (long) (raw_block - placed[i].first) * 512, SEEK_SET);
+			if (fread(dst, 1, 512, f)) {}
+			fclose(f);
+		}
+	}
+	raw_block++;
+	sd_bytes += 512;
+	sim_us += 512 * 2;
+	return 1;
+}
+
+uint8_t Sd2Card::readStop() {
+	raw_open = false;
+	return 1;
+}
+uint8_t SdVolume::init(Sd2Card&) { return 1; }
+uint8_t SdVolume::init(Sd2Card*) { return 1; }
+
+SdFile::SdFile() : impl(0) {}
+
+uint8_t SdFile::openRoot(SdVolume*) {
+	close();
+	HostFile* d = new HostFile();
+	d->path = getenv("SDROOT") ? getenv("SDROOT") : "/tmp/sdroot";
+	root_path = d->path;
+	d->dir = true;
+	d->f = 0;
+	d->pos = d->size = d->cluster = 0;
+	list(d);
+	impl = d;
+	return 1;
+}
+
+uint8_t SdFile::open(SdFile* dirFile, const char* fileName, uint8_t oflag) {
+	HostFile* p = (HostFile*) dirFile->impl;
+	uint8_t want[11], have[11];
+	std::string found;
+
+	card_free();
+	close();
+	to83(fileName, want);
+	for (size_t k = 2; k < p->entries.size(); k++) {
+		to83(p->entries[k], have);
+		if (!memcmp(want, have, 11)) found = p->entries[k];
+	}
+	if (found.empty()) {
+		if (!(oflag & O_CREAT) || readonly) return 0;
+		found = fileName;
+		FILE* f = fopen((p->path + "/" + found).c_str(), "wb");
+		if (!f) return 0;
+		fclose(f);
+		list(p);
+	}
+
+	HostFile* d = new HostFile();
+	struct stat st;
+	d->path = p->path + "/" + found;
+	stat(d->path.c_str(), &st);
+	d->pos = 0;
+	d->size = 0;
+	d->cluster = hash(d->path);
+	d->dir = S_ISDIR(st.st_mode);
+	d->f = 0;
+	if (d->dir) {
+		list(d);
+	}
+	else if ((oflag & O_TRUNC) && !readonly) {
+		d->f = fopen(d->path.c_str(), "w+b");
+	}
+	else {
+		d->f = fopen(d->path.c_str(), (oflag & O_WRITE) && !readonly ? "r+b" : "rb");
+		d->size = st.st_size;
+	}
+	sim_us += 2000;
+	sd_opens++;
+	impl = d;
+	return 1;
+}
+
+uint8_t SdFile::open(SdFile* dirFile, uint16_t index, uint8_t oflag) {
+	HostFile* p = (HostFile*) dirFile->impl;
+	uint8_t n83[11];
+	char name[13];
+	int k = 0;
+
+	if (index >= p->entries.size()) return 0;
+	to83(p->entries[index], n83);
+	for (int i = 0; i < 8; i++) if (n83[i] != ' ') name[k++] = n83[i];
+	if (n83[8] != ' ') {
+		name[k++] = '.';
+		for (int i = 8; i < 11; i++) if (n83[i] != ' ') name[k++] = n83[i];
+	}
+	name[k] = 0;
+	return open(dirFile, name, oflag);
+}
+
+uint8_t SdFile::close() {
+	if (impl) {
+		if (H->f) fclose(H->f);
+		delete H;
+		impl = 0;
+	}
+	return 1;
+}
+
+int16_t SdFile::read(void* buf, uint16_t nbyte) {
+	card_free();
+	if (!impl || H->dir) return -1;
+	fseek(H->f, H->pos, SEEK_SET);
+	size_t got = fread(buf, 1, nbyte, H->f);
+	H->pos += got;
+	sd_reads++;
+	sd_bytes += got;
+	sim_us += sd_latency_us + got * 2;
+	return got;
+}
+
+int16_t SdFile::read() {
+	uint8_t c;
+	return read(&c, 1) == 1 ? c : -1;
+}
+
+size_t SdFile::write(const void* buf, uint16_t nbyte) {
+	card_free();
+	if (!impl || !H->f || readonly) return 0;
+	fseek(H->f, H->pos, SEEK_SET);
+	fwrite(buf, 1, nbyte, H->f);
+	H->pos += nbyte;
+	if (H->pos > H->size) H->size = H->pos;
+	sim_us += 500 + nbyte * 2;
+	return nbyte;
+}
+
+int8_t SdFile::readDir(dir_t* dir) {
+	card_free();
+	if (!impl || !H->dir) return -1;
+	memset(dir, 0, sizeof(*dir));
+
+	// past the last entry the directory reads as free entries.
+	if (H->pos / 32 >= H->entries.size()) {
+		H->pos += 32;
+		return sizeof(dir_t);
+	}
+	std::string n = H->entries[H->pos / 32];
+	H->pos += 32;
+	sim_us += 50;
+
+	if (n == "." || n == "..") {
+		memset(dir->name, ' ', 11);
+		dir->name[0] = '.';
+		if (n == "..") dir->name[1] = '.';
+		dir->attributes = DIR_ATT_DIRECTORY;
+		return sizeof(dir_t);
+	}
+
+	std::string path = H->path + "/" + n;
+	struct stat st;
+	uint32_t cluster = hash(path);
+	stat(path.c_str(), &st);
+	to83(n, dir->name);
+	dir->attributes = S_ISDIR(st.st_mode) ? DIR_ATT_DIRECTORY : 0;
+	dir->fileSize = S_ISDIR(st.st_mode) ? 0 : st.st_size;
+	dir->firstClusterHigh = cluster >> 16;
+	dir->firstClusterLow = cluster & 0xffff;
+	dir->lastWriteDate = (uint16_t)(st.st_mtime >> 16);
+	dir->lastWriteTime = (uint16_t) st.st_mtime;
+	return sizeof(dir_t);
+}
+
+void SdFile::rewind() { if (impl) H->pos = 0; }
+
+uint8_t SdFile::seekSet(uint32_t pos) {
+	if (!impl || (!H->dir && pos > H->size)) return 0;
+	if (pos != H->pos) sd_seeks++;
+	H->pos = pos;
+	return 1;
+}
+
+uint8_t SdFile::seekCur(int32_t pos) { return impl && seekSet(H->pos + pos); }
+uint8_t SdFile::seekEnd() { return impl && seekSet(H->size); }
+uint32_t SdFile::curPosition() const { return impl ? H->pos : 0; }
+uint32_t SdFile::fileSize() const { return impl && !H->dir ? H->size : 0; }
+uint32_t SdFile::firstCluster() const { return impl ? H->cluster : 0; }
+uint8_t SdFile::isOpen() const { return impl != 0; }
+uint8_t SdFile::isDir() const { return impl && H->dir; }
+uint8_t SdFile::sync() { if (impl && H->f) fflush(H->f); return !readonly; }
+
+uint8_t SdFile::contiguousRange(uint32_t* bgnBlock, uint32_t* endBlock) {
+	if (!impl || H->dir || fragmented) return 0;
+
+	uint32_t blocks = (H->size + 511) / 512;
+	size_t i = 0;
+
+	while (i < placed.size() && placed[i].second != H->path) i++;
+	if (i == placed.size()) {
+		placed.push_back(std::make_pair(next_block, H->path));
+		next_block += blocks + 10;
+	}
+	*bgnBlock = placed[i].first;
+	*endBlock = placed[i].first + (blocks ? blocks - 1 : 0);
+	return 1;
+}
+
+uint8_t SdFile::truncate(uint32_t size) {
+	if (!impl || !H->f || readonly) return 0;
+	fflush(H->f);
+	if (::truncate(H->path.c_str(), size)) return 0;
+	H->size = size;
+	if (H->pos > size) H->pos = size;
+	return 1;
+}
@@ -0,0 +1,49 @@
+// the host models behind the stand-ins, and what they count. the costs are
+// rough teensy 2.0 figures, so the totals are for comparing one tree with
+// another, not for reading off as the hardware's:
+//
+//   sd card     200 us ($SD_LATENCY) + 2 us/byte per read, 2 ms per open;
+//               a multi-block read pays the 200 us once
+//   decoder     2 KB fifo drained at 16 KB/s (128 kbit/s); dreq is high
+//               while 32 bytes fit; 2 us per byte sent. the mp3 library's
+//               is decoder 0, and decoder n (up to host_decoders - 1) has
+//               its dreq line on pin decoder_pin + n
+//   eeprom      3.3 ms per byte written; blank at first, or kept in
+//               $EEPROM_FILE from one run to the next
+//   uart        9600 baud ($UART_BAUD), ~1 ms per byte once its 40 byte
+//               transmit buffer is full
+//   millis()    5 us per call
+//
+// the card is the directory in $SDROOT (/tmp/sdroot if it isn't set), write
+// protected if $READONLY is set, and without contiguous files if $FRAGMENTED
+// is set. if $DECODED is set, everything sent to the decoder is written to
+// that file.
+
+#ifndef host_h
+#define host_h
+
+#include <string>
+
+extern unsigned long long sim_us;      // simulated time
+
+extern unsigned long sd_reads;
+extern unsigned long sd_bytes;
+extern unsigned long sd_seeks;         // seekSet()s that moved
+extern unsigned long sd_opens;         // files opened
+
+extern unsigned long eeprom_writes;
+extern unsigned long eeprom_cell_writes[1024];
+
+#define host_decoders 4
+#define decoder_pin 30
+
+extern unsigned long dec_bytes;        // sent to the decoders
+extern unsigned long dec_starved_us;   // their fifos sat empty mid-song
+void decoder_idle(int n = 0);          // not feeding on purpose, see host.cpp
+void decoder_play(int n, const unsigned char* data, int len);
+
+extern unsigned long uart_bytes;       // written to the uart
+extern unsigned long uart_wait_us;     // write() waited for its buffer
+extern std::string uart_in;            // still to arrive on the uart
+
+#endif
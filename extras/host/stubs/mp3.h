@@ -0,0 +1,20 @@
+// host stand-in for the vs10xx library. the decoder is modelled in host.cpp:
+// a 2 KB fifo, drained at the song's bitrate, that raises dreq while it has
+// room for 32 bytes.
+
+#ifndef mp3_h
+#define mp3_h
+
+#include <Arduino.h>
+
+class Mp3Class
+{
+  public:
+	void begin(int cs, int dcs, int rst, int dreq);
+	void play(const unsigned char* data, int len);
+	void volume(unsigned char level);
+};
+
+extern Mp3Class Mp3;
+
+#endif
@@ -0,0 +1 @@
+// the decoder's pins are set in Song.cpp; nothing to configure on the host.
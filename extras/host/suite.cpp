@@ -0,0 +1,123 @@
+// the benchmark suite: boots a player on a card (the one corpus -tags writes)
+// and measures, for each song on it, reading its tag and playing it. the
+// output is csv, one row per measurement:
+//
+//   case,stage,sd_reads,sd_bytes,seeks,ms,underruns
+//
+// boot is Song::setup() without fast boot, which indexes the whole library
+// before it returns (with fast boot, that would be spread over the play
+// rows that come after). for each song, scan is
+// Id3Tag::scan() and Mp3Info::analyze() on it, as for a song that isn't in
+// the index yet, and play is setSong() and play_ms of playing it with a busy
+// sketch: ms is the time loop() took, and underruns are the decoder's.
+//
+//   suite [dir [play_ms [sketch_us]]]
+//
+// dir is $SDROOT by default, play_ms 3000 and sketch_us 10000. the model is
+// deterministic, so two trees can be compared row by row: bench.csv is this
+// tree's output for a fresh corpus -tags card, and the bench test checks it.
+
+#include <SD.h>
+#include <CachedFile.h>
+#include <Id3Tag.h>
+#include <LibraryIndex.h>
+#include <Mp3Info.h>
+#include <Song.h>
+#include <host.h>
+
+struct Cost {
+	unsigned long reads, bytes, seeks, underruns;
+	unsigned long long us;
+};
+
+static Song* player;
+
+static Cost now() {
+	Cost c = { sd_reads, sd_bytes, sd_seeks, player->getUnderruns(), sim_us };
+	return c;
+}
+
+static void row(const char* name, const char* stage, const Cost& start, unsigned long long us) {
+	Cost c = now();
+	printf("%s,%s,%lu,%lu,%lu,%.1f,%lu\n", name, stage, c.reads - start.reads,
+		c.bytes - start.bytes, c.seeks - start.seeks, us / 1000.0,
+		c.underruns - start.underruns);
+}
+
+// the songs in the root directory, in the order the library numbers them.
+
+static int songs(char names[][13], int max) {
+	Sd2Card card;
+	SdVolume volume;
+	SdFile root;
+	dir_t p;
+	int n = 0;
+
+	card.init(SPI_FULL_SPEED, SS_PIN);
+	volume.init(card);
+	root.openRoot(&volume);
+	while (n < max && root.readDir(&p) > 0 && p.name[0] != DIR_NAME_FREE) {
+		if (!DIR_IS_FILE(&p) || (memcmp(p.name + 8, "MP3", 3) && memcmp(p.name + 8, "WAV", 3))) continue;
+		LibraryIndex::formatName((char*) p.name, names[n++]);
+	}
+	root.close();
+	return n;
+}
+
+static void scan(const char* name) {
+	Sd2Card card;
+	SdVolume volume;
+	SdFile root;
+	CachedFile file;
+	Id3Tag tag;
+	Mp3Info info;
+
+	card.init(SPI_FULL_SPEED, SS_PIN);
+	volume.init(card);
+	root.openRoot(&volume);
+	file.open(&root, name, O_READ);
+
+	Cost start = now();
+	tag.scan(&file, name);
+	info.analyze(&file, tag.getAudioStart(), tag.getAudioEnd());
+	row(name, "scan", start, sim_us - start.us);
+	file.close();
+	root.close();
+}
+
+int main(int argc, char** argv) {
+	if (argc > 1) setenv("SDROOT", argv[1], 1);
+	unsigned long play_ms = argc > 2 ? atol(argv[2]) : 3000;
+	unsigned long sketch_us = argc > 3 ? atol(argv[3]) : 10000;
+
+	setvbuf(stdout, 0, _IONBF, 0);
+	JsonHandler handler;
+	Song song;
+	char names[32][13];
+
+	player = &song;
+	printf("case,stage,sd_reads,sd_bytes,seeks,ms,underruns\n");
+
+	Cost start = now();
+	handler.setup();
+	song.setup(&handler, false);
+	row("library", "boot", start, sim_us - start.us);
+
+	int n = songs(names, 32);
+	for (int i = 0; i < n; i++) {
+		scan(names[i]);
+
+		start = now();
+		unsigned long long busy = sim_us;
+		song.setSong(i);
+		busy = sim_us - busy;
+		while (sim_us - start.us < play_ms * 1000ULL) {
+			unsigned long long t = sim_us;
+			song.loop();
+			busy += sim_us - t;
+			sim_us += sketch_us;
+		}
+		row(names[i], "play", start, busy);
+	}
+	return 0;
+}